@@ -1,18 +1,27 @@
 #include <vector>
 #include <cstdint>
+#include <cstring>
+#include <span>
 #include <fstream>
 #include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <array>
-
-const double VagLutDecoder[5][2] = {
-    {0.0, 0.0},               // 0
-    {60.0 / 64.0, 0.0},       // 1
-    {115.0 / 64.0, -52.0 / 64.0},  // 2
-    {98.0 / 64.0,  -55.0 / 64.0},  // 3
-    {122.0 / 64.0, -60.0 / 64.0}   // 4
+#include <cfloat>
+#include <atomic>
+#include <thread>
+
+// predictor coefficients in 64ths, as the SPU applies them
+const int VagLutFixed[5][2] = {
+    {0, 0},         // 0
+    {60, 0},        // 1
+    {115, -52},     // 2
+    {98, -55},      // 3
+    {122, -60}      // 4
 };
+// shift nibble -> shift actually applied, 13-15 behave like 9 on hardware
+const int8_t VagShiftTable[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 9, 9, 9 };
+
 struct VAGChunk {
     int8_t  shift;    // lower nibble
     int8_t  predict;  // upper nibble
@@ -20,196 +29,628 @@ struct VAGChunk {
     uint8_t sample[14];
 };
 
-std::vector<uint8_t> EncodeAdpcm1(const std::vector<int16_t>& pcmData, int numChannels = 1)
+// the SPU's predictor, in the integer arithmetic decoder and encoder share
+inline int Adpcm1Predict(int predict, int hist_1, int hist_2)
 {
-    const int samplesPerChunk = 28;
-    std::vector<uint8_t> output;
+    return (hist_1 * VagLutFixed[predict][0] + hist_2 * VagLutFixed[predict][1] + 32) >> 6;
+}
+
+inline int Adpcm1Clamp(int sample)
+{
+    return sample < -32768 ? -32768 : (sample > 32767 ? 32767 : sample);
+}
+
+// ADPCM_1 encoder with per-channel history.
+//
+// every 28-sample chunk is tried against all predictor/shift pairs at once: 5 predictors x 16 shift lanes
+// (shifts 13-15 unused) run side by side over plain arrays the compiler turns into SIMD. the lanes use the
+// decoder's own integer arithmetic, so the error they report is exactly what playback will produce.
+//   Fast      picks the predictor from the source signal, searches only its shifts
+//   Balanced  searches every pair
+//   Quality   searches every pair, then re-quantizes the best few looking one sample ahead
+class Adpcm1Encoder {
+public:
+    enum Preset { Fast, Balanced, Quality };
+
+    static constexpr int samples_per_chunk = 28;
+    static constexpr size_t frame_size = 16;
+
+    explicit Adpcm1Encoder(int numChannels = 1, Preset preset = Balanced)
+        : num_channels(numChannels > 0 ? numChannels : 1), preset(preset), hist_1(num_channels, 0), hist_2(num_channels, 0) {}
+
+    // header frame, one frame per channel per 28 frames (the last one zero padded), end frames
+    static size_t encoded_size(size_t num_samples, int numChannels) {
+        const size_t ch = numChannels > 0 ? numChannels : 1;
+        return frame_size + ((num_samples / ch + samples_per_chunk - 1) / samples_per_chunk) * ch * frame_size + ch * frame_size;
+    }
 
-    if (pcmData.empty())
-        return output;
+    // tracks longer than one segment are cut into segments of segment_chunks chunks that encode independently,
+    // on up to num_threads threads. each segment warms its history up on the warmup_chunks before it, and the
+    // joins are then repaired in order: the start of a segment is re-encoded from the true history left by the
+    // previous one until both agree again, for at most join_chunks chunks. the layout doesn't depend on
+    // num_threads, so neither does the output
+    std::vector<uint8_t> encode(std::span<const int16_t> pcmData, unsigned num_threads = 1);
+    // the same into out, which needs encoded_size() bytes. returns the bytes written, 0 when out is too small
+    size_t encode(std::span<const int16_t> pcmData, std::span<uint8_t> out, unsigned num_threads = 1);
+
+    static constexpr size_t segment_chunks = 4096;
+    static constexpr size_t warmup_chunks = 16;
+    static constexpr size_t join_chunks = 64;
+
+    // encodes up to 28 samples of one channel, stride apart, into a 16-byte frame
+    void encode_chunk(int ch, const int16_t* samples, size_t stride, size_t count, uint8_t* frame);
+
+private:
+    static constexpr int num_predictors = 5;
+    static constexpr int shift_lanes = 16;
+    static constexpr int num_lanes = num_predictors * shift_lanes;
+    static constexpr int max_shift = 12;
+
+    struct Candidate {
+        int predict, shift;
+        float error;
+    };
+
+    void search(int h1, int h2, const int (&x)[samples_per_chunk], int first_predictor, int last_predictor,
+                Candidate* best, int num_best) const;
+    static int64_t quantize(int predict, int shift, int& h1, int& h2, const int (&x)[samples_per_chunk], int (&q)[samples_per_chunk], bool lookahead);
+    static int pick_predictor(int h1, int h2, const int (&x)[samples_per_chunk]);
+    // runs a frame through the decoder's history, as playback will
+    static void advance(const uint8_t* frame, int& h1, int& h2);
+
+    int num_channels;
+    Preset preset;
+    std::vector<int> hist_1, hist_2;        // the decoder's history, per channel
+
+    friend class Adpcm1StreamEncoder;
+};
 
-    size_t totalSamples = pcmData.size() / numChannels;
-    std::vector<double> hist_1(numChannels, 0.0);
-    std::vector<double> hist_2(numChannels, 0.0);
+// runs every lane of the chosen predictors over the chunk, keeps the num_best lowest errors
+inline void Adpcm1Encoder::search(int h1, int h2, const int (&x)[samples_per_chunk], int first_predictor, int last_predictor,
+                                  Candidate* best, int num_best) const
+{
+    const int first_lane = first_predictor * shift_lanes;
+    const int end_lane = (last_predictor + 1) * shift_lanes;
+
+    alignas(64) int16_t f0[num_lanes], f1[num_lanes], lh1[num_lanes], lh2[num_lanes];
+    alignas(64) int32_t mul[num_lanes], step[num_lanes];
+    alignas(64) float err[num_lanes];      // only ranks candidates, float keeps it in 32-bit lanes
+    for (int j = first_lane; j < end_lane; ++j) {
+        const int shift = std::min(j % shift_lanes, max_shift);
+        f0[j] = VagLutFixed[j / shift_lanes][0];
+        f1[j] = VagLutFixed[j / shift_lanes][1];
+        mul[j] = 1 << shift;
+        step[j] = 4096 >> shift;
+        lh1[j] = int16_t(h1);
+        lh2[j] = int16_t(h2);
+        err[j] = 0;
+    }
 
-    size_t pos = 0;
-    while (pos < totalSamples) {
-        for (int ch = 0; ch < numChannels; ++ch) {
-            size_t chStart = pos * numChannels + ch;
+    for (int i = 0; i < samples_per_chunk; ++i) {
+        const int32_t s = x[i];
+        for (int j = first_lane; j < end_lane; ++j) {
+            const int32_t pred = (lh1[j] * f0[j] + lh2[j] * f1[j] + 32) >> 6;
+            int32_t q = ((s - pred) * mul[j] + 2048) >> 12;
+            q = q < -8 ? -8 : (q > 7 ? 7 : q);
+            int32_t recon = pred + q * step[j];
+            recon = recon < -32768 ? -32768 : (recon > 32767 ? 32767 : recon);
+            const float e = float(s - recon);
+            err[j] += e * e;
+            lh2[j] = lh1[j];
+            lh1[j] = int16_t(recon);
+        }
+    }
 
-            // Check bounds
-            if (chStart + (samplesPerChunk - 1) * numChannels >= pcmData.size())
+    for (int n = 0; n < num_best; ++n)
+        best[n] = { 0, 0, FLT_MAX };
+    for (int j = first_lane; j < end_lane; ++j) {
+        if (j % shift_lanes > max_shift)
+            continue;
+        // insertion into the short sorted list, ties keep the lower predictor/shift like the old search
+        for (int n = 0; n < num_best; ++n) {
+            if (err[j] < best[n].error) {
+                for (int m = num_best - 1; m > n; --m)
+                    best[m] = best[m - 1];
+                best[n] = { j / shift_lanes, j % shift_lanes, err[j] };
                 break;
+            }
+        }
+    }
+}
 
-            double bestError = std::numeric_limits<double>::max();
-            int bestPredict = 0, bestShift = 0;
-            std::array<int, 28> bestQuantized{};
-
-            for (int predict = 0; predict <= 4; ++predict) {
-                for (int shift = 0; shift <= 12; ++shift) {
-                    double h1 = hist_1[ch];
-                    double h2 = hist_2[ch];
-                    std::array<int, 28> quantized{};
-                    double error = 0.0;
-
-                    for (int i = 0; i < samplesPerChunk; ++i) {
-                        size_t idx = chStart + i * numChannels;
-                        if (idx >= pcmData.size()) break;
-
-                        double predicted = h1 * VagLutDecoder[predict][0] + h2 * VagLutDecoder[predict][1];
-                        double delta = pcmData[idx] - predicted;
-                        double scaled = delta * std::pow(2.0, shift) / 4096.0;
-                        int q = static_cast<int>(std::lrint(scaled));
-                        q = std::clamp(q, -8, 7);
-
-                        double recon = predicted + q * 4096.0 / std::pow(2.0, shift);
-                        error += std::pow(pcmData[idx] - recon, 2);
-
-                        quantized[i] = q;
-                        h2 = h1;
-                        h1 = recon;
-                    }
-
-                    if (error < bestError) {
-                        bestError = error;
-                        bestPredict = predict;
-                        bestShift = shift;
-                        bestQuantized = quantized;
-                    }
+// quantizes one chunk for a predictor/shift pair, returns the squared error and leaves h1/h2 where the decoder will be.
+// without lookahead every sample takes the nearest step, with it a neighbouring step wins if it serves the next sample better
+inline int64_t Adpcm1Encoder::quantize(int predict, int shift, int& h1, int& h2, const int (&x)[samples_per_chunk], int (&q)[samples_per_chunk], bool lookahead)
+{
+    const int mul = 1 << shift;
+    const int step = 4096 >> shift;
+    auto nearest = [mul](int s, int pred) { return std::clamp(((s - pred) * mul + 2048) >> 12, -8, 7); };
+
+    int64_t error = 0;
+    for (int i = 0; i < samples_per_chunk; ++i) {
+        const int pred = Adpcm1Predict(predict, h1, h2);
+        int qi = nearest(x[i], pred);
+
+        if (lookahead && i + 1 < samples_per_chunk) {
+            int64_t best_cost = INT64_MAX;
+            const int first = std::max(qi - 1, -8), last = std::min(qi + 1, 7);
+            int best_q = qi;
+            for (int c = first; c <= last; ++c) {
+                const int r = Adpcm1Clamp(pred + c * step);
+                const int next_pred = Adpcm1Predict(predict, r, h1);
+                const int r2 = Adpcm1Clamp(next_pred + nearest(x[i + 1], next_pred) * step);
+                const int64_t cost = int64_t(x[i] - r) * (x[i] - r) + int64_t(x[i + 1] - r2) * (x[i + 1] - r2);
+                if (cost < best_cost || (cost == best_cost && c == qi)) {
+                    best_cost = cost;
+                    best_q = c;
                 }
             }
+            qi = best_q;
+        }
 
-            output.push_back((bestPredict << 4) | (bestShift & 0x0F));
-            output.push_back(0x00);
-
-            for (int i = 0; i < 14; ++i) {
-                int q0 = bestQuantized[i * 2] & 0x0F;
-                int q1 = bestQuantized[i * 2 + 1] & 0x0F;
-                output.push_back((q1 << 4) | q0);
-            }
+        const int recon = Adpcm1Clamp(pred + qi * step);
+        error += int64_t(x[i] - recon) * (x[i] - recon);
+        q[i] = qi;
+        h2 = h1;
+        h1 = recon;
+    }
+    return error;
+}
 
-            // Update history
-            for (int i = 0; i < samplesPerChunk; ++i) {
-                double predicted = hist_1[ch] * VagLutDecoder[bestPredict][0] + hist_2[ch] * VagLutDecoder[bestPredict][1];
-                double recon = predicted + bestQuantized[i] * 4096.0 / std::pow(2.0, bestShift);
-                hist_2[ch] = hist_1[ch];
-                hist_1[ch] = recon;
-            }
+// the predictor with the smallest peak residual on the source itself
+inline int Adpcm1Encoder::pick_predictor(int h1, int h2, const int (&x)[samples_per_chunk])
+{
+    int best = 0;
+    int best_peak = INT32_MAX;
+    for (int p = 0; p < num_predictors; ++p) {
+        int s1 = h1, s2 = h2, peak = 0;
+        for (int i = 0; i < samples_per_chunk; ++i) {
+            peak = std::max(peak, std::abs(x[i] - Adpcm1Predict(p, s1, s2)));
+            s2 = s1;
+            s1 = x[i];
         }
+        if (peak < best_peak) {
+            best_peak = peak;
+            best = p;
+        }
+    }
+    return best;
+}
 
-        pos += samplesPerChunk;
+inline void Adpcm1Encoder::encode_chunk(int ch, const int16_t* samples, size_t stride, size_t count, uint8_t* frame)
+{
+    int x[samples_per_chunk] = {};
+    for (size_t i = 0; i < count && i < samples_per_chunk; ++i)
+        x[i] = samples[i * stride];
+
+    Candidate best[4];
+    int num_best = 1;
+    if (preset == Fast) {
+        const int p = pick_predictor(hist_1[ch], hist_2[ch], x);
+        search(hist_1[ch], hist_2[ch], x, p, p, best, 1);
+    }
+    else {
+        num_best = preset == Quality ? 4 : 1;
+        search(hist_1[ch], hist_2[ch], x, 0, num_predictors - 1, best, num_best);
     }
 
-    for (int ch = 0; ch < numChannels; ++ch) {
-        output.push_back(0x00);      // predict/shift
-        output.push_back(0x03);      // flags
-        for (int i = 0; i < 14; ++i)
-            output.push_back(0x00);
+    int q[samples_per_chunk];
+    int predict = best[0].predict, shift = best[0].shift;
+    int h1 = hist_1[ch], h2 = hist_2[ch];
+    int64_t bestError = quantize(predict, shift, h1, h2, x, q, preset == Quality);
+    for (int n = 1; n < num_best; ++n) {
+        int other[samples_per_chunk];
+        int oh1 = hist_1[ch], oh2 = hist_2[ch];
+        const int64_t error = quantize(best[n].predict, best[n].shift, oh1, oh2, x, other, true);
+        if (error < bestError) {
+            bestError = error;
+            predict = best[n].predict;
+            shift = best[n].shift;
+            h1 = oh1;
+            h2 = oh2;
+            std::copy(std::begin(other), std::end(other), q);
+        }
     }
-    return output;
+    hist_1[ch] = h1;
+    hist_2[ch] = h2;
+
+    frame[0] = uint8_t((predict << 4) | (shift & 0x0F));
+    frame[1] = 0x00;
+    for (int i = 0; i < 14; ++i)
+        frame[2 + i] = uint8_t(((q[i * 2 + 1] & 0x0F) << 4) | (q[i * 2] & 0x0F));
 }
 
+inline void Adpcm1Encoder::advance(const uint8_t* frame, int& h1, int& h2)
+{
+    const int shift = VagShiftTable[frame[0] & 0x0F];
+    const int predict = std::min(frame[0] >> 4, 4);
+    for (int i = 0; i < samples_per_chunk; ++i) {
+        const int s = (int32_t(int8_t(i & 1 ? frame[2 + i / 2] & 0xF0 : frame[2 + i / 2] << 4)) << 8) >> shift;
+        const int recon = Adpcm1Clamp(s + Adpcm1Predict(predict, h1, h2));
+        h2 = h1;
+        h1 = recon;
+    }
+}
 
-std::vector<int16_t> DecodeAdpcm1(
-    const std::vector<uint8_t>& vagData,
-    bool enableDithering = false,
-    double ditherAmount = 0.2,
-    bool applyLowPassFilter = false,
-    double lpFilterAlpha = 0.95,
-    bool removeDC = false
-)
+inline std::vector<uint8_t> Adpcm1Encoder::encode(std::span<const int16_t> pcmData, unsigned num_threads)
 {
-    const size_t MIN_SIZE = 16;
-    if (vagData.size() < MIN_SIZE)
-        return {};
+    std::vector<uint8_t> output(pcmData.empty() ? 0 : encoded_size(pcmData.size(), num_channels));
+    output.resize(encode(pcmData, output, num_threads));
+    return output;
+}
 
-    std::vector<int16_t> pcmData;
-    pcmData.reserve(vagData.size() * 2);
-
-    size_t pos = 16; // Skip the 16-byte VAG header
-
-    double hist_1 = 0.0, hist_2 = 0.0;
-    while (pos + 16 <= vagData.size()) {
-        // ----------------------
-        // Parse one 16-byte VAG chunk
-        // ----------------------
-        VAGChunk vc;
-
-        // Byte 0: shift and predict nibble
-        // lower nibble = shift
-        // upper nibble = predict index
-        {
-            uint8_t decodingCoefficient = vagData[pos++];
-            vc.shift = decodingCoefficient & 0x0F;
-            vc.predict = (decodingCoefficient & 0xF0) >> 4;
+inline size_t Adpcm1Encoder::encode(std::span<const int16_t> pcmData, std::span<uint8_t> out, unsigned num_threads)
+{
+    const size_t outputSize = encoded_size(pcmData.size(), num_channels);
+    if (pcmData.empty() || out.size() < outputSize)
+        return 0;
+
+    const size_t totalSamples = pcmData.size() / num_channels;
+    const size_t totalChunks = (totalSamples + samples_per_chunk - 1) / samples_per_chunk;
+    const size_t numSegments = (totalChunks + segment_chunks - 1) / segment_chunks;
+
+    // the decoder skips the first frame, so it's left zeroed. every chunk frame is written in full below
+    std::memset(out.data(), 0, frame_size);
+    uint8_t* const frames = out.data() + frame_size;
+    auto frame_at = [&](size_t chunk, int ch) { return frames + (chunk * num_channels + ch) * frame_size; };
+    auto encode_range = [&](Adpcm1Encoder& enc, size_t first, size_t last, bool keep) {
+        uint8_t scratch[frame_size];
+        for (size_t chunk = first; chunk < last; ++chunk) {
+            const size_t pos = chunk * samples_per_chunk;
+            const size_t count = std::min<size_t>(samples_per_chunk, totalSamples - pos);
+            for (int ch = 0; ch < num_channels; ++ch)
+                enc.encode_chunk(ch, pcmData.data() + pos * num_channels + ch, num_channels, count, keep ? frame_at(chunk, ch) : scratch);
+        }
+    };
+
+    if (numSegments <= 1)
+        encode_range(*this, 0, totalChunks, true);
+    else {
+        // history each segment assumed at its start
+        std::vector<std::vector<int>> start_1(numSegments), start_2(numSegments);
+        std::atomic<size_t> next_segment{ 0 };
+        auto worker = [&] {
+            for (size_t seg; (seg = next_segment++) < numSegments; ) {
+                const size_t first = seg * segment_chunks;
+                Adpcm1Encoder enc(num_channels, preset);
+                if (seg == 0) {
+                    enc.hist_1 = hist_1;
+                    enc.hist_2 = hist_2;
+                }
+                encode_range(enc, first - std::min(first, warmup_chunks), first, false);
+                start_1[seg] = enc.hist_1;
+                start_2[seg] = enc.hist_2;
+                encode_range(enc, first, std::min(totalChunks, first + segment_chunks), true);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned t = 1; t < std::min<size_t>(num_threads, numSegments); ++t)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& t : threads)
+            t.join();
+
+        // walk the joins in order, with h1/h2 always the history the decoder really has at that point
+        for (int ch = 0; ch < num_channels; ++ch) {
+            int h1 = hist_1[ch], h2 = hist_2[ch];
+            for (size_t seg = 0; seg < numSegments; ++seg) {
+                const size_t first = seg * segment_chunks;
+                const size_t last = std::min(totalChunks, first + segment_chunks);
+                int o1 = start_1[seg][ch], o2 = start_2[seg][ch];
+                size_t chunk = first;
+
+                // re-encode until the true history lands where the segment's own encoder was
+                hist_1[ch] = h1;
+                hist_2[ch] = h2;
+                for (; chunk < last && chunk - first < join_chunks && (h1 != o1 || h2 != o2); ++chunk) {
+                    advance(frame_at(chunk, ch), o1, o2);
+                    const size_t pos = chunk * samples_per_chunk;
+                    encode_chunk(ch, pcmData.data() + pos * num_channels + ch, num_channels,
+                                 std::min<size_t>(samples_per_chunk, totalSamples - pos), frame_at(chunk, ch));
+                    h1 = hist_1[ch];
+                    h2 = hist_2[ch];
+                }
+
+                // agreed (or gave up): the rest stands as encoded, follow it to the end of the segment
+                for (; chunk < last; ++chunk)
+                    advance(frame_at(chunk, ch), h1, h2);
+            }
+            hist_1[ch] = h1;
+            hist_2[ch] = h2;
         }
+    }
+
+    uint8_t* frame = frames + totalChunks * num_channels * frame_size;
+    std::memset(frame, 0, size_t(num_channels) * frame_size);
+    for (int ch = 0; ch < num_channels; ++ch, frame += frame_size)
+        frame[1] = 0x03;      // flags
+    return outputSize;
+}
+
+// bytes EncodeAdpcm1() produces for num_samples interleaved samples
+inline size_t Adpcm1EncodedSize(size_t num_samples, int numChannels)
+{
+    return num_samples ? Adpcm1Encoder::encoded_size(num_samples, numChannels) : 0;
+}
+
+std::vector<uint8_t> EncodeAdpcm1(std::span<const int16_t> pcmData, int numChannels = 1,
+                                  Adpcm1Encoder::Preset preset = Adpcm1Encoder::Balanced, unsigned numThreads = 1)
+{
+    return Adpcm1Encoder(numChannels, preset).encode(pcmData, numThreads);
+}
+
+// into a caller's buffer of Adpcm1EncodedSize() bytes, returns the bytes written
+size_t EncodeAdpcm1(std::span<const int16_t> pcmData, int numChannels, std::span<uint8_t> out,
+                    Adpcm1Encoder::Preset preset = Adpcm1Encoder::Balanced, unsigned numThreads = 1)
+{
+    return Adpcm1Encoder(numChannels, preset).encode(pcmData, out, numThreads);
+}
+
+// incremental encoder, fed interleaved samples in pieces of any size and appending to out; finish() once at the end.
+// it walks encode()'s segments in order, warming each segment's encoder up on the chunks before it and repairing
+// the join chunk by chunk against the history playback really has, so the bytes are exactly encode()'s while
+// only a partial chunk and the last warmup_chunks chunks are ever held
+class Adpcm1StreamEncoder {
+public:
+    explicit Adpcm1StreamEncoder(int numChannels = 1, Adpcm1Encoder::Preset preset = Adpcm1Encoder::Balanced)
+        : num_channels(numChannels > 0 ? numChannels : 1), preset(preset), segment(num_channels, preset), truth(num_channels, preset),
+          start_1(num_channels, 0), start_2(num_channels, 0),
+          recent(Adpcm1Encoder::warmup_chunks * Adpcm1Encoder::samples_per_chunk * num_channels) {}
+
+    void encode(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out);
+    void finish(std::vector<uint8_t>& out);
+
+private:
+    static constexpr size_t chunk_frames = Adpcm1Encoder::samples_per_chunk;
+    static constexpr size_t frame_size = Adpcm1Encoder::frame_size;
+
+    // count frames, a whole chunk but for the very last one
+    void encode_chunk(const int16_t* pcm, size_t count, std::vector<uint8_t>& out);
+
+    int num_channels;
+    Adpcm1Encoder::Preset preset;
+    Adpcm1Encoder segment;                  // the current segment's own encoder
+    Adpcm1Encoder truth;                    // its history is what playback has, re-encodes the start of a segment to match
+    std::vector<int> start_1, start_2;      // where the segment's encoder has got to, while its join is being repaired
+    std::vector<int16_t> recent;            // the last warmup_chunks whole chunks, indexed by chunk % warmup_chunks
+    std::vector<int16_t> pending;           // less than a chunk of samples
+    size_t chunks = 0;
+};
 
-        // Byte 1: flags
-        vc.flags = vagData[pos++];
+inline void Adpcm1StreamEncoder::encode(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out)
+{
+    const size_t chunk_samples = chunk_frames * num_channels;
+
+    if (!pending.empty()) {
+        const size_t take = std::min(chunk_samples - pending.size(), num_samples);
+        pending.insert(pending.end(), pcm, pcm + take);
+        pcm += take;
+        num_samples -= take;
+        if (pending.size() < chunk_samples)
+            return;
+        encode_chunk(pending.data(), chunk_frames, out);
+        pending.clear();
+    }
+    for (; num_samples >= chunk_samples; pcm += chunk_samples, num_samples -= chunk_samples)
+        encode_chunk(pcm, chunk_frames, out);
+    pending.assign(pcm, pcm + num_samples);
+}
 
-        // Next 14 bytes: nibble-packed samples
-        std::copy(vagData.begin() + pos,
-            vagData.begin() + pos + 14,
-            vc.sample);
-        pos += 14;
+inline void Adpcm1StreamEncoder::finish(std::vector<uint8_t>& out)
+{
+    // like encode(), a trailing partial frame is dropped, though a track of nothing else still gets the header and end frames
+    if (pending.size() >= size_t(num_channels))
+        encode_chunk(pending.data(), pending.size() / num_channels, out);
+    else if (!pending.empty() && !chunks)
+        out.resize(out.size() + frame_size, 0);
+    else if (!chunks)
+        return;
+    pending.clear();
+
+    const size_t at = out.size();
+    out.resize(at + num_channels * frame_size, 0);
+    for (int ch = 0; ch < num_channels; ++ch)
+        out[at + ch * frame_size + 1] = 0x03;      // flags
+}
+
+inline void Adpcm1StreamEncoder::encode_chunk(const int16_t* pcm, size_t count, std::vector<uint8_t>& out)
+{
+    const size_t chunk_samples = chunk_frames * num_channels;
+    const size_t first = chunks - chunks % Adpcm1Encoder::segment_chunks;
+
+    // the decoder skips the first frame, so it's left zeroed
+    if (!chunks)
+        out.resize(out.size() + frame_size, 0);
+
+    // a new segment: a fresh encoder warmed up on the chunks before it, oldest first from where recent wraps
+    static_assert(Adpcm1Encoder::warmup_chunks <= Adpcm1Encoder::segment_chunks, "the warm-up must fit in the segment before");
+    if (chunks == first && chunks) {
+        segment = Adpcm1Encoder(num_channels, preset);
+        uint8_t scratch[frame_size];
+        for (size_t w = 0; w < Adpcm1Encoder::warmup_chunks; ++w) {
+            const size_t slot = (chunks + w) % Adpcm1Encoder::warmup_chunks;
+            for (int ch = 0; ch < num_channels; ++ch)
+                segment.encode_chunk(ch, recent.data() + slot * chunk_samples + ch, num_channels, chunk_frames, scratch);
+        }
+        start_1 = segment.hist_1;
+        start_2 = segment.hist_2;
+    }
 
-        // If end-flag encountered, break
-        if (vc.flags == 0x03) {
-            break;
+    const size_t at = out.size();
+    out.resize(at + num_channels * frame_size);
+    for (int ch = 0; ch < num_channels; ++ch) {
+        uint8_t* frame = out.data() + at + ch * frame_size;
+        segment.encode_chunk(ch, pcm + ch, num_channels, count, frame);
+
+        int& h1 = truth.hist_1[ch];
+        int& h2 = truth.hist_2[ch];
+        if (chunks - first < Adpcm1Encoder::join_chunks && (h1 != start_1[ch] || h2 != start_2[ch])) {
+            // still apart: follow the segment's own frame, then replace it with one encoded from the real history
+            Adpcm1Encoder::advance(frame, start_1[ch], start_2[ch]);
+            truth.encode_chunk(ch, pcm + ch, num_channels, count, frame);
         }
+        else
+            Adpcm1Encoder::advance(frame, h1, h2);
+    }
 
-        // ----------------------
-        // Unpack 28 4-bit samples from the 14 bytes
-        // ----------------------
-        int samples[28];
-        for (int j = 0; j < 14; ++j) {
-            // Low nibble
-            samples[j * 2 + 0] = (vc.sample[j] & 0x0F);
-            // High nibble
-            samples[j * 2 + 1] = ((vc.sample[j] & 0xF0) >> 4);
+    if (count == chunk_frames)
+        std::copy(pcm, pcm + chunk_samples, recent.begin() + (chunks % Adpcm1Encoder::warmup_chunks) * chunk_samples);
+    ++chunks;
+}
+
+// incremental decoder, fed whole 16-byte chunks; stops at the end flag.
+// integer arithmetic throughout, bit for bit what the SPU plays back. frames take turns between the channels
+// the way Adpcm1Encoder writes them, each with its channel's own history, and come out interleaved once every
+// channel's frame of a round is in
+struct Adpcm1Decoder {
+    static constexpr size_t frame_size = 16;
+
+    int num_channels;
+    std::vector<int> hist_1, hist_2;
+    std::vector<int16_t> round;     // the current round's samples, interleaved, while it is incomplete
+    int channel = 0;                // the channel the next frame belongs to
+    size_t bytes_seen = 0;
+    bool finished = false;
+
+    bool enableDithering = false;
+    double ditherAmount = 0.2;
+
+    explicit Adpcm1Decoder(int numChannels = 1)
+        : num_channels(numChannels > 0 ? numChannels : 1), hist_1(num_channels, 0), hist_2(num_channels, 0),
+          round(num_channels > 1 ? 28 * num_channels : 0) {}
+
+    // a round left over from the previous call can complete in this one
+    size_t max_samples(size_t num_bytes) const { return (num_bytes / frame_size + num_channels - 1) / num_channels * num_channels * 28; }
+    bool done() const { return finished; }
+
+    size_t decode(const uint8_t* vagData, size_t num_bytes, int16_t* out)
+    {
+        int16_t* const start = out;
+        size_t pos = 0;
+
+        // Skip the 16-byte VAG header
+        if (bytes_seen < 16) {
+            pos = std::min(num_bytes, size_t(16) - bytes_seen);
+            bytes_seen += pos;
         }
 
-        // ----------------------
-        // Decode each 4-bit sample into 16-bit PCM
-        // ----------------------
-        const int predictIndex = std::clamp<int>(vc.predict, 0, 4);
-        for (int j = 0; j < 28; j++) {
-            // Sign-extend 4-bit to 32-bit
-            // s is in the high nibble
-            int s = samples[j];
-            // If the 4-bit is >= 8, it should be negative
-            if (s & 0x08) {
-                s |= 0xFFFFFFF0; // sign-extend into 32 bits
+        while (!finished && pos + 16 <= num_bytes) {
+            // ----------------------
+            // Parse one 16-byte VAG chunk
+            // ----------------------
+            VAGChunk vc;
+
+            // Byte 0: shift and predict nibble
+            // lower nibble = shift
+            // upper nibble = predict index
+            {
+                uint8_t decodingCoefficient = vagData[pos++];
+                vc.shift = VagShiftTable[decodingCoefficient & 0x0F];
+                vc.predict = (decodingCoefficient & 0xF0) >> 4;
             }
 
-            // Shift into place. Original formula typically does: s << 12
-            // Then shift it right by vc.shift. We can combine:
-            // final_sample = (s << 12) >> vc.shift
-            // We'll do it in floating point:
-            double sample = static_cast<double>(s << 12) / std::pow(2.0, vc.shift);
-
-            // Apply the ADPCM predictor filter
-            sample += hist_1 * VagLutDecoder[predictIndex][0]
-                + hist_2 * VagLutDecoder[predictIndex][1];
-
-            // Update history
-            hist_2 = hist_1;
-            hist_1 = sample;
-
-            // Optional dithering
-            if (enableDithering) {
-                // Add random noise in [-0.5, +0.5), then multiply by ditherAmount
-                double randVal = (double(rand()) / double(RAND_MAX) - 0.5);
-                sample += randVal * ditherAmount;
+            // Byte 1: flags
+            vc.flags = vagData[pos++];
+
+            // Next 14 bytes: nibble-packed samples
+            std::copy(vagData + pos, vagData + pos + 14, vc.sample);
+            pos += 14;
+            bytes_seen += 16;
+
+            // If end-flag encountered, break
+            if (vc.flags == 0x03) {
+                finished = true;
+                break;
             }
 
-            // Clamp to 16-bit range
-            double clamped = std::clamp(sample, -32768.0, 32767.0);
+            // ----------------------
+            // Unpack 28 4-bit samples from the 14 bytes, already shifted into place: (s << 12) >> shift.
+            // moving a nibble to the top of an int8_t sign-extends it for free, and nothing here depends
+            // on the history so the compiler vectorizes it
+            // ----------------------
+            int32_t samples[28];
+            const int shift = vc.shift;
+            for (int j = 0; j < 14; ++j) {
+                samples[j * 2 + 0] = (int32_t(int8_t(vc.sample[j] << 4)) << 8) >> shift;  // Low nibble
+                samples[j * 2 + 1] = (int32_t(int8_t(vc.sample[j] & 0xF0)) << 8) >> shift; // High nibble
+            }
 
-            // Convert to int16
-            pcmData.push_back(static_cast<int16_t>(std::lrint(clamped)));
+            // ----------------------
+            // Apply the predictor filter, the only serial part
+            // ----------------------
+            const int predictIndex = std::clamp<int>(vc.predict, 0, 4);
+            int& h1 = hist_1[channel];
+            int& h2 = hist_2[channel];
+            int16_t* dst = num_channels == 1 ? out : round.data() + channel;
+            for (int j = 0; j < 28; j++) {
+                const int sample = Adpcm1Clamp(samples[j] + Adpcm1Predict(predictIndex, h1, h2));
+
+                // Update history
+                h2 = h1;
+                h1 = sample;
+
+                // Optional dithering, on the output only
+                if (enableDithering) {
+                    // Add random noise in [-0.5, +0.5), then multiply by ditherAmount
+                    double randVal = (double(rand()) / double(RAND_MAX) - 0.5);
+                    dst[j * num_channels] = static_cast<int16_t>(std::clamp<long>(std::lrint(sample + randVal * ditherAmount), -32768, 32767));
+                }
+                else
+                    dst[j * num_channels] = static_cast<int16_t>(sample);
+            }
+
+            if (++channel == num_channels) {
+                channel = 0;
+                if (num_channels > 1)
+                    std::copy(round.begin(), round.end(), out);
+                out += 28 * num_channels;
+            }
         }
+        return size_t(out - start);
     }
+};
+
+// samples a payload decodes to, every whole round of frames after the header one up to the end flag
+inline size_t Adpcm1DecodedSize(std::span<const uint8_t> vagData, int numChannels = 1)
+{
+    const size_t ch = size_t(std::max(numChannels, 1));
+    size_t frames = 0;
+    for (size_t pos = Adpcm1Decoder::frame_size; pos + Adpcm1Decoder::frame_size <= vagData.size() && vagData[pos + 1] != 0x03;
+         pos += Adpcm1Decoder::frame_size)
+        ++frames;
+    return frames / ch * ch * 28;
+}
+
+// into a caller's buffer of Adpcm1DecodedSize() samples, returns the samples written
+size_t DecodeAdpcm1(std::span<const uint8_t> vagData, int numChannels, std::span<int16_t> out)
+{
+    if (out.size() < Adpcm1DecodedSize(vagData, numChannels))
+        return 0;
+    Adpcm1Decoder decoder(numChannels);
+    return decoder.decode(vagData.data(), vagData.size(), out.data());
+}
+
+std::vector<int16_t> DecodeAdpcm1(
+    std::span<const uint8_t> vagData,
+    int numChannels = 1,
+    bool enableDithering = false,
+    double ditherAmount = 0.2,
+    bool applyLowPassFilter = false,
+    double lpFilterAlpha = 0.95,
+    bool removeDC = false
+)
+{
+    const size_t MIN_SIZE = 16;
+    if (vagData.size() < MIN_SIZE)
+        return {};
+
+    Adpcm1Decoder decoder(numChannels);
+    decoder.enableDithering = enableDithering;
+    decoder.ditherAmount = ditherAmount;
+
+    std::vector<int16_t> pcmData(Adpcm1DecodedSize(vagData, numChannels));
+    decoder.decode(vagData.data(), vagData.size(), pcmData.data());
 
     if (applyLowPassFilter && !pcmData.empty()) {
         int16_t prevOut = pcmData[0];
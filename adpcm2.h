@@ -1,11 +1,17 @@
 #pragma once
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <span>
+#include <algorithm>
+#include <thread>
 
-static const int xindexTable[16] = {
+constexpr int xindexTable[16] = {
     -1, -1, -1, -1, 2, 4, 6, 6,
     -1, -1, -1, -1, 2, 4, 6, 6
 };
 
-static const int xstepsizeTable[89] = {
+constexpr int xstepsizeTable[89] = {
     7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
     19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
     50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
@@ -17,124 +23,270 @@ static const int xstepsizeTable[89] = {
     15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
 };
 
-std::vector<int16_t> DecodeAdpcm2(const std::vector<uint8_t>& adpcm_data, int num_channels)
-{
-    size_t offset = 0;
-    const size_t blockSize = 36 * num_channels;
-    const size_t numBlocks = adpcm_data.size() / blockSize;
-    std::vector<int16_t> pcm_output;
-
-    pcm_output.reserve(numBlocks * 64 * num_channels);
-
-    for (size_t block = 0; block < numBlocks; ++block) {
-        struct ChannelState {
-            int predictor;
-            int index;
-        } state[2];
-
-        for (int ch = 0; ch < num_channels; ++ch) {
-            state[ch].predictor = static_cast<int16_t>(adpcm_data[offset] | (adpcm_data[offset + 1] << 8));
-            state[ch].index = std::clamp(static_cast<int>(adpcm_data[offset + 2]), 0, 88);
-            offset += 4; //reserved
-            pcm_output.push_back(state[ch].predictor);
-        }
+// (step index, nibble) -> signed difference and next step index, as ImaAdpcmTable but for this codec's tables
+struct Adpcm2Table {
+    int32_t diff[89][16];
+    uint8_t next_index[89][16];
 
-        for (int sample = 1; sample < 64; sample += 2) {
-            for (int ch = 0; ch < num_channels; ++ch) {
-                uint8_t byte = adpcm_data[offset++];
+    constexpr Adpcm2Table() : diff(), next_index() {
+        for (int index = 0; index < 89; ++index) {
+            for (int code = 0; code < 16; ++code) {
+                const int step = xstepsizeTable[index];
+                int d = step >> 3;
+                if (code & 4) d += step;
+                if (code & 2) d += step >> 1;
+                if (code & 1) d += step >> 2;
+                diff[index][code] = (code & 8) ? -d : d;
+                next_index[index][code] = uint8_t(std::clamp(index + xindexTable[code], 0, 88));
+            }
+        }
+    }
+};
+inline constexpr Adpcm2Table adpcm2Table{};
 
-                for (int shift = 0; shift <= 4; shift += 4) {
-                    int nibble = (byte >> shift) & 0x0F;
+// block layout, per block of num_channels channels:
+//   per channel: int16 predictor, uint8 index, uint8 reserved
+//   32 rounds of one byte per channel, two nibbles each (low first)
+// decoded, a block is 65 interleaved frames: the header samples, then each channel's nibbles in order. every
+// (block, channel) pair is a stream of its own, which is what the kernels below exploit
+struct Adpcm2Blocks {
+    static constexpr int samples_per_block = 65;
+    static constexpr int header_size = 4;
+    static constexpr int data_size = 32;
 
-                    int step = xstepsizeTable[state[ch].index];
-                    int diff = step >> 3;
-                    if (nibble & 4) diff += step;
-                    if (nibble & 2) diff += step >> 1;
-                    if (nibble & 1) diff += step >> 2;
+    // streams run side by side in lanes, plain arrays the compiler can vectorize across
+    static constexpr size_t lanes = 8;
 
-                    if (nibble & 8)
-                        state[ch].predictor -= diff;
-                    else
-                        state[ch].predictor += diff;
+    // where stream s = block * num_channels + ch finds its header, its n-th nibble byte and its output samples
+    struct Layout {
+        size_t num_channels;
 
-                    state[ch].predictor = std::clamp(state[ch].predictor, -32768, 32767);
+        size_t block_bytes() const { return (header_size + data_size) * num_channels; }
+        size_t header(size_t s) const { return (s / num_channels) * block_bytes() + (s % num_channels) * header_size; }
+        size_t byte(size_t s, int j) const { return (s / num_channels) * block_bytes() + header_size * num_channels + j * num_channels + s % num_channels; }
+        size_t first_out(size_t s) const { return (s / num_channels) * samples_per_block * num_channels + s % num_channels; }
+        size_t out(size_t s, int n) const { return (s / num_channels) * samples_per_block * num_channels + (1 + n) * num_channels + s % num_channels; }
+    };
 
-                    state[ch].index += xindexTable[nibble];
-                    state[ch].index = std::clamp(state[ch].index, 0, 88);
+    // decodes streams [first, last)
+    static void decode_streams(const uint8_t* data, const Layout& layout, size_t first, size_t last, int16_t* out)
+    {
+        for (size_t s0 = first; s0 < last; s0 += lanes) {
+            const size_t count = std::min(lanes, last - s0);
+            int32_t predictor[lanes] = {}, index[lanes] = {};
+            for (size_t l = 0; l < count; ++l) {
+                const uint8_t* h = data + layout.header(s0 + l);
+                predictor[l] = static_cast<int16_t>(h[0] | (h[1] << 8));
+                index[l] = std::clamp(static_cast<int>(h[2]), 0, 88);
+                out[layout.first_out(s0 + l)] = static_cast<int16_t>(predictor[l]);
+            }
 
-                    pcm_output.push_back(static_cast<int16_t>(state[ch].predictor));
+            for (int n = 0; n < 2 * data_size; ++n) {
+                for (size_t l = 0; l < count; ++l) {
+                    const int code = (data[layout.byte(s0 + l, n / 2)] >> ((n & 1) * 4)) & 0x0F;
+                    predictor[l] = std::clamp(predictor[l] + adpcm2Table.diff[index[l]][code], -32768, 32767);
+                    index[l] = adpcm2Table.next_index[index[l]][code];
+                    out[layout.out(s0 + l, n)] = static_cast<int16_t>(predictor[l]);
                 }
             }
         }
     }
 
-    return pcm_output;
-}
+    // a starting step that can already follow the block's first move instead of ramping up from the smallest
+    static int initial_index(int first, int second)
+    {
+        const int d = std::abs(second - first);
+        int index = 0;
+        while (index < 88 && xstepsizeTable[index] * 15 / 8 < d)
+            ++index;
+        return index;
+    }
 
-std::vector<uint8_t> EncodeAdpcm2(const std::vector<int16_t>& pcm, int numChannels)
-{
-    int16_t predictor[2] = { 0 };
-    int index[2] = { 0 };
-
-    const size_t samplesPerBlock = 64;
-    const size_t blockSize = 36 * numChannels;
-    std::vector<uint8_t> encoded;
-    size_t totalSamples = pcm.size() / numChannels;
-
-    for (size_t blockStart = 0; blockStart < totalSamples; blockStart += samplesPerBlock) {
-        for (int ch = 0; ch < numChannels; ++ch) {
-            size_t chOffset = blockStart * numChannels + ch;
-            predictor[ch] = (blockStart + 0 < totalSamples) ? pcm[chOffset] : 0;
-            index[ch] = 0;
-            encoded.push_back(predictor[ch] & 0xFF);
-            encoded.push_back((predictor[ch] >> 8) & 0xFF);
-            encoded.push_back(index[ch]);
-            encoded.push_back(0);
-        }
+    // encodes streams [first, last) from pcm laid out the way decode_streams() writes it, num_samples values in all
+    static void encode_streams(const int16_t* pcm, size_t num_samples, const Layout& layout, size_t first, size_t last, uint8_t* out)
+    {
+        for (size_t s0 = first; s0 < last; s0 += lanes) {
+            const size_t count = std::min(lanes, last - s0);
+            int32_t predictor[lanes] = {}, index[lanes] = {};
 
-        for (size_t i = 1; i < samplesPerBlock; i += 2) {
-            for (int ch = 0; ch < numChannels; ++ch) {
-                uint8_t packed = 0;
-                for (int nib = 0; nib < 2; ++nib) {
-                    size_t sampleIndex = blockStart + i + nib;
-                    size_t pcmIndex = sampleIndex * numChannels + ch;
+            for (size_t l = 0; l < count; ++l) {
+                const size_t s = s0 + l;
+                const size_t head = layout.first_out(s), next = layout.out(s, 0);
+                predictor[l] = head < num_samples ? pcm[head] : 0;
+                index[l] = initial_index(predictor[l], next < num_samples ? pcm[next] : predictor[l]);
 
-                    int step = xstepsizeTable[index[ch]];
-                    int diff = pcmIndex < pcm.size() ? pcm[pcmIndex] - predictor[ch] : 0;
+                uint8_t* h = out + layout.header(s);
+                h[0] = uint8_t(predictor[l] & 0xFF);
+                h[1] = uint8_t((predictor[l] >> 8) & 0xFF);
+                h[2] = uint8_t(index[l]);
+                h[3] = 0;
+            }
+
+            for (int n = 0; n < 2 * data_size; ++n) {
+                for (size_t l = 0; l < count; ++l) {
+                    const size_t pos = layout.out(s0 + l, n);
+                    // past the end the predictor is held, as if the track went on at its last value
+                    int diff = pos < num_samples ? pcm[pos] - predictor[l] : 0;
+                    const int negative = diff >> 31;
+                    diff = (diff ^ negative) - negative;
 
-                    int nibble = 0;
-                    if (diff < 0) {
-                        nibble = 8;
-                        diff = -diff;
+                    int step = xstepsizeTable[index[l]];
+                    int code = negative & 8;
+                    for (int bit = 4; bit; bit >>= 1, step >>= 1) {
+                        const int set = -(diff >= step);
+                        code |= set & bit;
+                        diff -= set & step;
                     }
 
-                    int mask = step;
-                    if (diff >= mask) { nibble |= 4; diff -= mask; }
-                    mask >>= 1;
-                    if (diff >= mask) { nibble |= 2; diff -= mask; }
-                    mask >>= 1;
-                    if (diff >= mask) { nibble |= 1; }
-
-                    int delta = step >> 3;
-                    if (nibble & 1) delta += step >> 2;
-                    if (nibble & 2) delta += step >> 1;
-                    if (nibble & 4) delta += step;
-                    if (nibble & 8) delta = -delta;
-
-                    predictor[ch] += delta;
-                    predictor[ch] = std::clamp<int16_t>(predictor[ch], -32768, 32767);
-
-                    index[ch] += xindexTable[nibble];
-                    index[ch] = std::clamp(index[ch], 0, 88);
-
-                    if (nib == 0)
-                        packed |= (nibble & 0x0F);
-                    else
-                        packed |= (nibble & 0x0F) << 4;
+                    predictor[l] = std::clamp(predictor[l] + adpcm2Table.diff[index[l]][code], -32768, 32767);
+                    index[l] = adpcm2Table.next_index[index[l]][code];
+
+                    uint8_t& byte = out[layout.byte(s0 + l, n / 2)];
+                    byte = (n & 1) ? uint8_t(byte | (code << 4)) : uint8_t(code);
                 }
-                encoded.push_back(packed);
             }
         }
     }
+
+    // splits [0, num_streams) into one contiguous run per thread, whole lane groups each
+    template <class Work>
+    static void for_each_run(size_t num_streams, unsigned num_threads, Work&& work)
+    {
+        const size_t groups = (num_streams + lanes - 1) / lanes;
+        const size_t runs = std::max<size_t>(1, std::min<size_t>(num_threads, groups));
+        const size_t per_run = (groups + runs - 1) / runs * lanes;
+
+        std::vector<std::thread> threads;
+        for (size_t r = 1; r < runs; ++r) {
+            const size_t first = r * per_run;
+            if (first < num_streams)
+                threads.emplace_back([&work, first, last = std::min(num_streams, first + per_run)] { work(first, last); });
+        }
+        work(0, std::min(num_streams, per_run));
+        for (auto& t : threads)
+            t.join();
+    }
+};
+
+// incremental decoder, fed whole blocks; every block carries its own predictor and index
+struct Adpcm2Decoder {
+    size_t frame_size;
+    int num_channels;
+
+    explicit Adpcm2Decoder(int num_channels = 1) : frame_size(36 * num_channels), num_channels(num_channels) {}
+
+    // the header sample plus 32 bytes of two nibbles per channel
+    size_t max_samples(size_t num_bytes) const { return (num_bytes / frame_size) * 65 * num_channels; }
+    bool done() const { return false; }
+
+    size_t decode(const uint8_t* adpcm_data, size_t num_bytes, int16_t* out)
+    {
+        const size_t numBlocks = num_bytes / frame_size;
+        Adpcm2Blocks::decode_streams(adpcm_data, { size_t(num_channels) }, 0, numBlocks * num_channels, out);
+        return numBlocks * 65 * num_channels;
+    }
+};
+
+// samples a payload of num_bytes decodes to, whole blocks only
+inline size_t Adpcm2DecodedSize(size_t num_bytes, int num_channels)
+{
+    const size_t ch = size_t(std::max(num_channels, 1));
+    return num_bytes / ((Adpcm2Blocks::header_size + Adpcm2Blocks::data_size) * ch) * Adpcm2Blocks::samples_per_block * ch;
+}
+
+// bytes num_samples interleaved samples encode to, one block per 65 frames
+inline size_t Adpcm2EncodedSize(size_t num_samples, int num_channels)
+{
+    const Adpcm2Blocks::Layout layout{ size_t(std::max(num_channels, 1)) };
+    const size_t blockSamples = Adpcm2Blocks::samples_per_block * layout.num_channels;
+    return (num_samples + blockSamples - 1) / blockSamples * layout.block_bytes();
+}
+
+// blocks don't depend on each other, so long tracks are spread over num_threads threads.
+// out needs Adpcm2DecodedSize() samples, returns the samples written
+size_t DecodeAdpcm2(std::span<const uint8_t> adpcm_data, int num_channels, std::span<int16_t> out, unsigned num_threads = 1)
+{
+    const Adpcm2Blocks::Layout layout{ size_t(std::max(num_channels, 1)) };
+    const size_t numBlocks = adpcm_data.size() / layout.block_bytes();
+    const size_t numSamples = numBlocks * Adpcm2Blocks::samples_per_block * layout.num_channels;
+    if (out.size() < numSamples)
+        return 0;
+
+    Adpcm2Blocks::for_each_run(numBlocks * layout.num_channels, num_threads, [&](size_t first, size_t last) {
+        Adpcm2Blocks::decode_streams(adpcm_data.data(), layout, first, last, out.data());
+    });
+    return numSamples;
+}
+
+std::vector<int16_t> DecodeAdpcm2(std::span<const uint8_t> adpcm_data, int num_channels, unsigned num_threads = 1)
+{
+    std::vector<int16_t> pcm_output(Adpcm2DecodedSize(adpcm_data.size(), num_channels));
+    DecodeAdpcm2(adpcm_data, num_channels, pcm_output, num_threads);
+    return pcm_output;
+}
+
+// the inverse of DecodeAdpcm2(): one block per 65 frames (header sample + 64 nibbles), the last one padded by holding the final value.
+// out needs Adpcm2EncodedSize() bytes, returns the bytes written
+size_t EncodeAdpcm2(std::span<const int16_t> pcm, int numChannels, std::span<uint8_t> out, unsigned num_threads = 1)
+{
+    const Adpcm2Blocks::Layout layout{ size_t(std::max(numChannels, 1)) };
+    const size_t numBytes = Adpcm2EncodedSize(pcm.size(), numChannels);
+    if (out.size() < numBytes)
+        return 0;
+
+    Adpcm2Blocks::for_each_run(numBytes / layout.block_bytes() * layout.num_channels, num_threads, [&](size_t first, size_t last) {
+        Adpcm2Blocks::encode_streams(pcm.data(), pcm.size(), layout, first, last, out.data());
+    });
+    return numBytes;
+}
+
+std::vector<uint8_t> EncodeAdpcm2(std::span<const int16_t> pcm, int numChannels, unsigned num_threads = 1)
+{
+    std::vector<uint8_t> encoded(Adpcm2EncodedSize(pcm.size(), numChannels));
+    EncodeAdpcm2(pcm, numChannels, encoded, num_threads);
     return encoded;
 }
+
+// incremental encoder, fed interleaved samples in pieces of any size and appending to out; finish() once at the end.
+// blocks are independent, so only a partial block is ever buffered and the bytes are exactly EncodeAdpcm2()'s
+struct Adpcm2StreamEncoder {
+    Adpcm2Blocks::Layout layout;
+    std::vector<int16_t> pending;   // less than a block of samples
+
+    explicit Adpcm2StreamEncoder(int num_channels = 1) : layout{ size_t(std::max(num_channels, 1)) } {}
+
+    void encode(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out)
+    {
+        const size_t block_samples = Adpcm2Blocks::samples_per_block * layout.num_channels;
+
+        if (!pending.empty()) {
+            const size_t take = std::min(block_samples - pending.size(), num_samples);
+            pending.insert(pending.end(), pcm, pcm + take);
+            pcm += take;
+            num_samples -= take;
+            if (pending.size() < block_samples)
+                return;
+            run(pending.data(), block_samples, out);
+            pending.clear();
+        }
+
+        const size_t whole = num_samples / block_samples * block_samples;
+        run(pcm, whole, out);
+        pending.assign(pcm + whole, pcm + num_samples);
+    }
+
+    void finish(std::vector<uint8_t>& out)
+    {
+        run(pending.data(), pending.size(), out);
+        pending.clear();
+    }
+
+private:
+    void run(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out)
+    {
+        const size_t numBytes = Adpcm2EncodedSize(num_samples, int(layout.num_channels));
+        const size_t at = out.size();
+        out.resize(at + numBytes);
+        Adpcm2Blocks::encode_streams(pcm, num_samples, layout, 0, numBytes / layout.block_bytes() * layout.num_channels, out.data() + at);
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// fast non-cryptographic 64 bit hash for content addressing, stable across runs and platforms (little endian).
+// four independent multiply-rotate lanes over 32 byte blocks, then a murmur style finalizer
+class ContentHash {
+public:
+    explicit ContentHash(uint64_t seed = 0) {
+        lanes[0] = seed + prime1 + prime2;
+        lanes[1] = seed + prime2;
+        lanes[2] = seed;
+        lanes[3] = seed - prime1;
+    }
+
+    ContentHash& update(std::span<const uint8_t> bytes) {
+        total += bytes.size();
+        const uint8_t* p = bytes.data();
+        size_t n = bytes.size();
+
+        // top up a block left over from the last call first
+        if (pending) {
+            const size_t take = n < 32 - pending ? n : 32 - pending;
+            std::memcpy(buffer + pending, p, take);
+            pending += take;
+            p += take;
+            n -= take;
+            if (pending < 32)
+                return *this;
+            block(buffer);
+            pending = 0;
+        }
+        for (; n >= 32; p += 32, n -= 32)
+            block(p);
+        std::memcpy(buffer, p, n);
+        pending = n;
+        return *this;
+    }
+
+    ContentHash& update(uint64_t value) {
+        uint8_t bytes[8];
+        for (int i = 0; i < 8; ++i)
+            bytes[i] = uint8_t(value >> (8 * i));
+        return update(std::span<const uint8_t>(bytes));
+    }
+
+    uint64_t digest() const {
+        uint64_t h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        h ^= total * prime3;
+        for (size_t i = 0; i < pending; ++i)
+            h = rotl(h ^ (buffer[i] * prime1), 11) * prime2;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t of(std::span<const uint8_t> bytes, uint64_t seed = 0) { return ContentHash(seed).update(bytes).digest(); }
+
+private:
+    static constexpr uint64_t prime1 = 0x9E3779B185EBCA87ull;
+    static constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+    static constexpr uint64_t prime3 = 0x165667B19E3779F9ull;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t load64(const uint8_t* p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+
+    void block(const uint8_t* p) {
+        for (int i = 0; i < 4; ++i)
+            lanes[i] = rotl(lanes[i] + load64(p + 8 * i) * prime2, 31) * prime1;
+    }
+
+    uint64_t lanes[4];
+    uint64_t total = 0;
+    uint8_t buffer[32] = {};
+    size_t pending = 0;
+};
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "content_hash.h"
+
+// on-disk store of encoded payloads, addressed by a key describing what went into the encoder.
+//
+// each entry is <dir>/<first two hex digits>/<16 hex digit key>.bin:
+//   file_header_t
+//   uint8_t payload[size]
+// entries are written to a temporary name and renamed, so concurrent writers never expose half a file
+class EncodeCache {
+public:
+#pragma pack(push, 1)
+    struct file_header_t {
+        char magic[8];
+        uint64_t key;
+        uint64_t size;
+        uint64_t checksum;      // ContentHash of the payload
+    };
+#pragma pack(pop)
+
+    static constexpr char magic[8] = { 'W', 'B', 'K', 'E', 'N', 'C', '1', '\0' };
+
+    explicit EncodeCache(std::filesystem::path dir) : root(std::move(dir)) {}
+
+    // a damaged or mismatching entry counts as a miss
+    std::optional<std::vector<uint8_t>> load(uint64_t key);
+    bool store(uint64_t key, std::span<const uint8_t> payload);
+
+    size_t hits() const { return num_hits; }
+    size_t misses() const { return num_misses; }
+
+private:
+    std::filesystem::path path_of(uint64_t key) const;
+
+    std::filesystem::path root;
+    std::atomic<size_t> num_hits{ 0 };
+    std::atomic<size_t> num_misses{ 0 };
+    const unsigned tmp_tag = std::random_device{}();   // keeps temporary names apart between processes
+    std::atomic<unsigned> tmp_counter{ 0 };
+};
+
+inline std::filesystem::path EncodeCache::path_of(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof name, "%016llx.bin", (unsigned long long)key);
+    return root / std::string(name, 2) / name;
+}
+
+inline std::optional<std::vector<uint8_t>> EncodeCache::load(uint64_t key)
+{
+    std::ifstream in(path_of(key), std::ios::binary);
+    file_header_t hdr{};
+    if (in && in.read(reinterpret_cast<char*>(&hdr), sizeof hdr) &&
+        std::memcmp(hdr.magic, magic, sizeof magic) == 0 && hdr.key == key && hdr.size < (uint64_t(1) << 32)) {
+        std::vector<uint8_t> payload(size_t(hdr.size));
+        if (in.read(reinterpret_cast<char*>(payload.data()), payload.size()) && ContentHash::of(payload) == hdr.checksum) {
+            num_hits++;
+            return payload;
+        }
+    }
+    num_misses++;
+    return std::nullopt;
+}
+
+inline bool EncodeCache::store(uint64_t key, std::span<const uint8_t> payload)
+{
+    const std::filesystem::path path = path_of(key);
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    file_header_t hdr{};
+    std::memcpy(hdr.magic, magic, sizeof magic);
+    hdr.key = key;
+    hdr.size = payload.size();
+    hdr.checksum = ContentHash::of(payload);
+
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, ".%08x.%u.tmp", tmp_tag, tmp_counter++);
+    std::filesystem::path tmp = path;
+    tmp += suffix;
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&hdr), sizeof hdr);
+        out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+        out.close();
+        if (out.fail()) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "string_hash_dictionary.h"
+#include "thread_pool.h"
+
+// recovers names for string_hash::to_hash() values by enumerating candidates from patterns.
+//
+// a pattern is literal text mixed with placeholders, every combination is tried:
+//   {w}        each word of the word list
+//   {n:A-B}    the numbers A to B, zero padded to the width of A when A starts with 0 (e.g. {n:00-99}).
+//              at most max_range numbers, every one is kept in memory. a longer run is two placeholders,
+//              e.g. {n:0-99}{n:000000-999999} for 0 to 99999999
+//
+// to_hash() is a polynomial, so hash(x + y) = hash(x) * 33^len(y) + hash(y). every alternative is reduced
+// to that (hash, 33^len) pair once, after which a candidate costs one multiply-add per placeholder.
+class HashCracker {
+public:
+    explicit HashCracker(std::vector<uint32_t> unresolved);
+
+    // false with a message in error when the pattern doesn't parse
+    bool add_pattern(std::string_view pattern, const std::vector<std::string>& words, std::string& error);
+
+    // every (hash, name) found, sorted by hash then name
+    std::vector<std::pair<uint32_t, std::string>> run(ThreadPool& pool);
+
+    uint64_t candidates() const;
+
+    // most numbers a single {n:A-B} may hold
+    static constexpr uint64_t max_range = 1000000;
+
+private:
+    struct Part {
+        std::vector<std::string> values;
+        std::vector<uint32_t> hashes;
+        std::vector<uint32_t> pows;
+
+        void add(std::string value);
+        void append(std::string_view suffix);
+    };
+    using Pattern = std::vector<Part>;
+
+    // lanes hashed together in the inner loop, wide enough for the compiler to vectorize it
+    static constexpr size_t lanes = 16;
+    static constexpr int filter_bits = 22;
+
+    static uint32_t pow33(size_t n);
+    bool is_target(uint32_t hash) const;
+    void search(const Pattern& pattern, uint64_t outer_begin, uint64_t outer_end, size_t inner_begin, size_t inner_end,
+                std::vector<std::pair<uint32_t, std::string>>& hits) const;
+
+    std::vector<uint32_t> targets;      // sorted
+    std::vector<uint64_t> filter;       // one bit per top filter_bits of a target hash
+    std::vector<Pattern> patterns;
+};
+
+inline HashCracker::HashCracker(std::vector<uint32_t> unresolved)
+    : targets(std::move(unresolved)), filter(size_t(1) << (filter_bits - 6), 0)
+{
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+    for (uint32_t t : targets) {
+        const uint32_t bit = t >> (32 - filter_bits);
+        filter[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+inline uint32_t HashCracker::pow33(size_t n)
+{
+    uint32_t res = 1;
+    while (n--)
+        res *= 33;
+    return res;
+}
+
+inline void HashCracker::Part::add(std::string value)
+{
+    hashes.push_back(string_hash::to_hash(std::string_view(value)));
+    pows.push_back(pow33(value.size()));
+    values.push_back(std::move(value));
+}
+
+inline void HashCracker::Part::append(std::string_view suffix)
+{
+    const uint32_t suffix_hash = string_hash::to_hash(suffix);
+    const uint32_t suffix_pow = pow33(suffix.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        values[i] += suffix;
+        hashes[i] = hashes[i] * suffix_pow + suffix_hash;
+        pows[i] *= suffix_pow;
+    }
+}
+
+inline bool HashCracker::add_pattern(std::string_view pattern, const std::vector<std::string>& words, std::string& error)
+{
+    Pattern parts;
+    std::string literal;
+
+    // literal text is folded into the neighbouring placeholder so the innermost loop always has alternatives to batch
+    auto flush_literal = [&] {
+        if (literal.empty())
+            return;
+        if (!parts.empty())
+            parts.back().append(literal);
+        else {
+            parts.emplace_back();
+            parts.back().add(literal);
+        }
+        literal.clear();
+    };
+
+    for (size_t pos = 0; pos < pattern.size(); ) {
+        if (pattern[pos] != '{') {
+            literal += pattern[pos++];
+            continue;
+        }
+
+        const size_t close = pattern.find('}', pos);
+        if (close == std::string_view::npos) {
+            error = "unterminated '{'";
+            return false;
+        }
+        const std::string_view token = pattern.substr(pos + 1, close - pos - 1);
+        pos = close + 1;
+
+        Part part;
+        if (token == "w") {
+            for (const auto& word : words)
+                part.add(word);
+        }
+        else if (token.starts_with("n:")) {
+            const std::string_view range = token.substr(2);
+            const size_t dash = range.find('-');
+            uint64_t first = 0, last = 0;
+            if (dash == std::string_view::npos ||
+                std::from_chars(range.data(), range.data() + dash, first).ptr != range.data() + dash ||
+                std::from_chars(range.data() + dash + 1, range.data() + range.size(), last).ptr != range.data() + range.size() ||
+                last < first) {
+                error = "bad number range '" + std::string(token) + "'";
+                return false;
+            }
+            if (last - first >= max_range) {
+                error = "number range '" + std::string(token) + "' has more than " + std::to_string(max_range) + " values";
+                return false;
+            }
+            const size_t width = range[0] == '0' ? dash : 0;
+            for (uint64_t n = first; n <= last; ++n) {
+                std::string value = std::to_string(n);
+                if (value.size() < width)
+                    value.insert(0, width - value.size(), '0');
+                part.add(std::move(value));
+            }
+        }
+        else {
+            error = "unknown placeholder '{" + std::string(token) + "}'";
+            return false;
+        }
+
+        if (part.values.empty()) {
+            error = "placeholder '{" + std::string(token) + "}' has nothing to try";
+            return false;
+        }
+
+        // a literal prefix is glued onto the front of the first placeholder
+        if (parts.empty() && !literal.empty()) {
+            const uint32_t prefix_hash = string_hash::to_hash(std::string_view(literal));
+            for (size_t i = 0; i < part.values.size(); ++i) {
+                part.hashes[i] += prefix_hash * part.pows[i];
+                part.pows[i] *= pow33(literal.size());
+                part.values[i].insert(0, literal);
+            }
+            literal.clear();
+        }
+        flush_literal();
+        parts.push_back(std::move(part));
+    }
+    flush_literal();
+
+    if (parts.empty()) {
+        error = "empty pattern";
+        return false;
+    }
+    patterns.push_back(std::move(parts));
+    return true;
+}
+
+inline uint64_t HashCracker::candidates() const
+{
+    uint64_t total = 0;
+    for (const auto& pattern : patterns) {
+        uint64_t count = 1;
+        for (const auto& part : pattern)
+            count *= part.values.size();
+        total += count;
+    }
+    return total;
+}
+
+inline bool HashCracker::is_target(uint32_t hash) const
+{
+    return std::binary_search(targets.begin(), targets.end(), hash);
+}
+
+inline void HashCracker::search(const Pattern& pattern, uint64_t outer_begin, uint64_t outer_end, size_t inner_begin, size_t inner_end,
+                                std::vector<std::pair<uint32_t, std::string>>& hits) const
+{
+    const Part& inner = pattern.back();
+    const size_t num_outer_parts = pattern.size() - 1;
+    std::vector<size_t> digits(num_outer_parts);
+
+    for (uint64_t outer = outer_begin; outer < outer_end; ++outer) {
+        // mixed radix decode of the outer index, last outer part varies fastest
+        uint64_t rest = outer;
+        for (size_t p = num_outer_parts; p-- > 0; ) {
+            digits[p] = size_t(rest % pattern[p].values.size());
+            rest /= pattern[p].values.size();
+        }
+        uint32_t state = 0;
+        for (size_t p = 0; p < num_outer_parts; ++p)
+            state = state * pattern[p].pows[digits[p]] + pattern[p].hashes[digits[p]];
+
+        for (size_t base = inner_begin; base < inner_end; base += lanes) {
+            const size_t count = std::min(lanes, inner_end - base);
+            const uint32_t* pows = inner.pows.data() + base;
+            const uint32_t* hashes = inner.hashes.data() + base;
+
+            uint32_t h[lanes];
+            uint32_t maybe = 0;
+            if (count == lanes) {
+                for (size_t j = 0; j < lanes; ++j)
+                    h[j] = state * pows[j] + hashes[j];
+                for (size_t j = 0; j < lanes; ++j) {
+                    const uint32_t bit = h[j] >> (32 - filter_bits);
+                    maybe |= uint32_t((filter[bit >> 6] >> (bit & 63)) & 1) << j;
+                }
+            }
+            else {
+                for (size_t j = 0; j < count; ++j) {
+                    h[j] = state * pows[j] + hashes[j];
+                    const uint32_t bit = h[j] >> (32 - filter_bits);
+                    maybe |= uint32_t((filter[bit >> 6] >> (bit & 63)) & 1) << j;
+                }
+            }
+            if (!maybe)
+                continue;
+
+            for (size_t j = 0; j < count; ++j) {
+                if (!(maybe & (1u << j)) || !is_target(h[j]))
+                    continue;
+                std::string name;
+                for (size_t p = 0; p < num_outer_parts; ++p)
+                    name += pattern[p].values[digits[p]];
+                name += inner.values[base + j];
+                hits.emplace_back(h[j], std::move(name));
+            }
+        }
+    }
+}
+
+inline std::vector<std::pair<uint32_t, std::string>> HashCracker::run(ThreadPool& pool)
+{
+    std::vector<std::pair<uint32_t, std::string>> found;
+    std::mutex found_lock;
+
+    if (targets.empty())
+        return found;
+
+    // split into roughly a few dozen tasks per thread, across outer combinations and, when those run short, the inner alternatives
+    const uint64_t wanted_tasks = uint64_t(pool.size()) * 32;
+    for (const auto& pattern : patterns) {
+        uint64_t outer_count = 1;
+        for (size_t p = 0; p + 1 < pattern.size(); ++p)
+            outer_count *= pattern[p].values.size();
+        const size_t inner_count = pattern.back().values.size();
+
+        const uint64_t outer_step = std::max<uint64_t>(1, outer_count / wanted_tasks);
+        const uint64_t outer_tasks = (outer_count + outer_step - 1) / outer_step;
+        const size_t inner_step = outer_tasks >= wanted_tasks ? inner_count
+                                : std::max<size_t>(lanes * 64, inner_count / size_t(wanted_tasks / outer_tasks));
+
+        for (uint64_t outer = 0; outer < outer_count; outer += outer_step) {
+            for (size_t inner = 0; inner < inner_count; inner += inner_step) {
+                const uint64_t outer_end = std::min(outer_count, outer + outer_step);
+                const size_t inner_end = std::min(inner_count, inner + inner_step);
+                pool.submit([this, &pattern, &found, &found_lock, outer, outer_end, inner, inner_end] {
+                    std::vector<std::pair<uint32_t, std::string>> hits;
+                    search(pattern, outer, outer_end, inner, inner_end, hits);
+                    if (hits.empty())
+                        return;
+                    std::lock_guard guard(found_lock);
+                    found.insert(found.end(), std::make_move_iterator(hits.begin()), std::make_move_iterator(hits.end()));
+                });
+            }
+        }
+    }
+    pool.wait();
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    return found;
+}
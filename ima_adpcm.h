@@ -1,11 +1,14 @@
 #pragma once
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <span>
 
 struct ImaAdpcmState {
     int valprev = 0;
     int index = 0;
 };
-const int stepsizeTable[89] = {
+constexpr int stepsizeTable[89] = {
     7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
     34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
     157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544,
@@ -14,146 +17,281 @@ const int stepsizeTable[89] = {
     6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818,
     18499, 20350, 22385, 24623, 27086, 29794, 32767
 };
-const int indexTable[16] = {
+constexpr int indexTable[16] = {
     -1, -1, -1, -1, 2, 4, 6, 8,
     -1, -1, -1, -1, 2, 4, 6, 8
 };
 
-// taken from ALSA
-static std::vector<uint8_t> EncodeImaAdpcm(const std::vector<int16_t>& pcmSamples, int numChannels)
-{
-    std::vector<uint8_t> outBuff;
+// every (step index, nibble) pair resolved up front: the signed difference the nibble adds and the index it leads to.
+// decoding a nibble is then two loads and a clamp, no branches
+struct ImaAdpcmTable {
+    int32_t diff[89][16];
+    uint8_t next_index[89][16];
 
-    if (numChannels == 1)
-    {
-        ImaAdpcmState state = {};
-        bool hasHighNibble = false;
-        uint8_t nibbleBuffer = 0;
-
-        for (auto sample : pcmSamples) {
-            short diff = sample - state.valprev;
-            uint8_t sign = (diff < 0) ? 0x8 : 0x0;
-            if (sign) diff = -diff;
-
-            short step = stepsizeTable[state.index];
-            short pred_diff = step >> 3;
-
-            uint8_t adjust_idx = 0;
-            for (int i = 4; i; i >>= 1, step >>= 1) {
-                if (diff >= step) {
-                    adjust_idx |= i;
-                    diff -= step;
-                    pred_diff += step;
-                }
+    constexpr ImaAdpcmTable() : diff(), next_index() {
+        for (int index = 0; index < 89; ++index) {
+            for (int code = 0; code < 16; ++code) {
+                const int step = stepsizeTable[index];
+                int d = step >> 3;
+                if (code & 1) d += step >> 2;
+                if (code & 2) d += step >> 1;
+                if (code & 4) d += step;
+                diff[index][code] = (code & 8) ? -d : d;
+                next_index[index][code] = uint8_t(std::clamp(index + indexTable[code], 0, 88));
             }
+        }
+    }
+};
+inline constexpr ImaAdpcmTable imaAdpcmTable{};
 
-            state.valprev += sign ? -pred_diff : pred_diff;
-            state.valprev = std::clamp(state.valprev, -32768, 32767);
-            state.index += indexTable[adjust_idx];
-            state.index = std::clamp(state.index, 0, 88);
+inline void ImaAdpcmStep(ImaAdpcmState& state, int code)
+{
+    state.valprev = std::clamp(state.valprev + imaAdpcmTable.diff[state.index][code], -32768, 32767);
+    state.index = imaAdpcmTable.next_index[state.index][code];
+}
 
-            if (!hasHighNibble) {
-                nibbleBuffer = ((sign | adjust_idx) & 0x0F);
-                hasHighNibble = true;
-            }
-            else {
-                nibbleBuffer |= ((sign | adjust_idx) << 4);
-                outBuff.push_back(nibbleBuffer);
-                hasHighNibble = false;
-            }
-        }
+// one sample in, one nibble out. the bits are worked out with masks instead of branches, and the difference
+// they stand for is summed on the way, exactly as the decoder's table has it
+inline int ImaAdpcmEncodeSample(ImaAdpcmState& state, int sample)
+{
+    int diff = sample - state.valprev;      // int: a full scale swing doesn't fit a short
+    const int negative = diff >> 31;        // all ones when set
+    diff = (diff ^ negative) - negative;
 
-        if (hasHighNibble)
-            outBuff.push_back(nibbleBuffer);
+    int step = stepsizeTable[state.index];
+    int pred_diff = step >> 3;
+    int code = negative & 8;
+    for (int bit = 4; bit; bit >>= 1, step >>= 1) {
+        const int set = -(diff >= step);
+        code |= set & bit;
+        diff -= set & step;
+        pred_diff += set & step;
     }
-    else if (numChannels == 2)
-    {
-        ImaAdpcmState stateL = {}, stateR = {};
-        for (size_t i = 0; i + 1 < pcmSamples.size(); i += 2) {
-            auto encodeSample = [](int16_t sample, ImaAdpcmState& state) -> uint8_t {
-                short diff = sample - state.valprev;
-                uint8_t sign = (diff < 0) ? 0x8 : 0x0;
-                if (sign) diff = -diff;
-
-                short step = stepsizeTable[state.index];
-                short pred_diff = step >> 3;
-
-                uint8_t adjust_idx = 0;
-                for (int i = 4; i; i >>= 1, step >>= 1) {
-                    if (diff >= step) {
-                        adjust_idx |= i;
-                        diff -= step;
-                        pred_diff += step;
-                    }
-                }
-
-                state.valprev += sign ? -pred_diff : pred_diff;
-                state.valprev = std::clamp(state.valprev, -32768, 32767);
-                state.index += indexTable[adjust_idx];
-                state.index = std::clamp(state.index, 0, 88);
-                return sign | adjust_idx;
-            };
-
-            int16_t left = pcmSamples[i];
-            int16_t right = pcmSamples[i + 1];
-
-            uint8_t leftNib = encodeSample(left, stateL);
-            uint8_t rightNib = encodeSample(right, stateR);
-
-            outBuff.push_back((rightNib << 4) | (leftNib & 0x0F));
+
+    state.valprev = std::clamp(state.valprev + ((pred_diff ^ negative) - negative), -32768, 32767);
+    state.index = imaAdpcmTable.next_index[state.index][code];
+    return code;
+}
+
+// encode kernels specialized on the channel count like the decoder's, Channels = 0 handles any count.
+// pcm is little endian 16-bit, interleaved, read where it lies; nibble k of the output belongs to channel k % num_channels
+template <int Channels>
+inline void ImaAdpcmEncodeKernel(const uint8_t* pcm, size_t num_samples, uint8_t* out, ImaAdpcmState* states, size_t num_channels)
+{
+    auto load = [pcm](size_t i) { return int(int16_t(uint16_t(pcm[2 * i] | (pcm[2 * i + 1] << 8)))); };
+    const size_t pairs = num_samples / 2;
+
+    if constexpr (Channels == 1) {
+        ImaAdpcmState state = states[0];
+        for (size_t i = 0; i < pairs; ++i) {
+            const int lo = ImaAdpcmEncodeSample(state, load(2 * i));
+            const int hi = ImaAdpcmEncodeSample(state, load(2 * i + 1));
+            out[i] = uint8_t(lo | (hi << 4));
+        }
+        if (num_samples & 1)
+            out[pairs] = uint8_t(ImaAdpcmEncodeSample(state, load(num_samples - 1)));
+        states[0] = state;
+    }
+    else if constexpr (Channels == 2) {
+        ImaAdpcmState left = states[0], right = states[1];
+        for (size_t i = 0; i < pairs; ++i) {
+            const int lo = ImaAdpcmEncodeSample(left, load(2 * i));
+            const int hi = ImaAdpcmEncodeSample(right, load(2 * i + 1));
+            out[i] = uint8_t(lo | (hi << 4));
         }
+        if (num_samples & 1)
+            out[pairs] = uint8_t(ImaAdpcmEncodeSample(left, load(num_samples - 1)));
+        states[0] = left;
+        states[1] = right;
     }
     else {
-        printf("Unsupported number of channels\n");
+        size_t ch = 0;
+        auto next = [&](size_t i) {
+            const int code = ImaAdpcmEncodeSample(states[ch], load(i));
+            if (++ch == num_channels)
+                ch = 0;
+            return code;
+        };
+        for (size_t i = 0; i < pairs; ++i) {
+            const int lo = next(2 * i);
+            const int hi = next(2 * i + 1);
+            out[i] = uint8_t(lo | (hi << 4));
+        }
+        if (num_samples & 1)
+            out[pairs] = uint8_t(next(num_samples - 1));
     }
-
-    return outBuff;
 }
 
-static std::vector<uint8_t> EncodeImaAdpcm(const std::vector<uint8_t>& wavBytes, int numChannels)
+// bytes num_samples samples encode to, one nibble each
+inline size_t ImaAdpcmEncodedSize(size_t num_samples) { return (num_samples + 1) / 2; }
+
+// picks the kernel for num_channels. the targets are all little endian, so the samples already are the bytes it reads
+inline void ImaAdpcmEncodeChannels(const int16_t* pcm, size_t num_samples, uint8_t* out, ImaAdpcmState* states, size_t num_channels)
 {
-    std::vector<int16_t> pcmSamples;
-    for (size_t i = 0; i + 1 < wavBytes.size(); i += 2) {
-        pcmSamples.push_back((int16_t)(wavBytes[i] | (wavBytes[i + 1] << 8)));
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pcm);
+    switch (num_channels) {
+        case 1: ImaAdpcmEncodeKernel<1>(bytes, num_samples, out, states, 1); break;
+        case 2: ImaAdpcmEncodeKernel<2>(bytes, num_samples, out, states, 2); break;
+        default: ImaAdpcmEncodeKernel<0>(bytes, num_samples, out, states, num_channels); break;
     }
-    return EncodeImaAdpcm(pcmSamples, numChannels);
 }
 
-std::vector<int16_t> DecodeImaAdpcm(const std::vector<uint8_t>& samples, int num_channels = 1)
-{    
-    std::vector<ImaAdpcmState> states(num_channels);
+// pcm interleaved across numChannels, out needs ImaAdpcmEncodedSize() bytes. returns the bytes written
+inline size_t EncodeImaAdpcm(std::span<const int16_t> pcm, int numChannels, std::span<uint8_t> out)
+{
+    const size_t num_channels = size_t(std::max(numChannels, 1));
+    const size_t num_bytes = ImaAdpcmEncodedSize(pcm.size());
+    if (out.size() < num_bytes)
+        return 0;
 
-    size_t sample_count = (samples.size() * 2);
-    std::vector<int16_t> outBuff;
-    outBuff.resize(sample_count);
+    ImaAdpcmState fixed[2];
+    std::vector<ImaAdpcmState> states(num_channels > 2 ? num_channels : 0);
+    ImaAdpcmEncodeChannels(pcm.data(), pcm.size(), out.data(), num_channels > 2 ? states.data() : fixed, num_channels);
+    return num_bytes;
+}
 
-    int sample_idx = 0;
+inline std::vector<uint8_t> EncodeImaAdpcm(std::span<const int16_t> pcm, int numChannels)
+{
+    std::vector<uint8_t> outBuff(ImaAdpcmEncodedSize(pcm.size()));
+    EncodeImaAdpcm(pcm, numChannels, outBuff);
+    return outBuff;
+}
 
-    for (uint8_t byte : samples) {
-        for (int shift = 0; shift <= 4; shift += 4) {
-            uint8_t code = (byte >> shift) & 0x0F;
-            int channel = sample_idx % num_channels;
+// incremental encoder, fed interleaved samples in pieces of any size and appending to out; finish() once at the end.
+// the bytes are exactly what EncodeImaAdpcm() makes of the whole track
+struct ImaAdpcmStreamEncoder {
+    std::vector<ImaAdpcmState> states;
+    std::vector<int16_t> pending;   // less than two frames, so every run starts on channel 0 and a whole byte
 
-            auto& state = states[channel];
+    explicit ImaAdpcmStreamEncoder(int num_channels = 1) : states(std::max(num_channels, 1)) {}
 
-            int step = stepsizeTable[state.index];
-            int diff = step >> 3;
-            if (code & 1) diff += step >> 2;
-            if (code & 2) diff += step >> 1;
-            if (code & 4) diff += step;
+    void encode(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out)
+    {
+        const size_t unit = 2 * states.size();
+        if (!pending.empty()) {
+            const size_t take = std::min(unit - pending.size(), num_samples);
+            pending.insert(pending.end(), pcm, pcm + take);
+            pcm += take;
+            num_samples -= take;
+            if (pending.size() < unit)
+                return;
+            run(pending.data(), unit, out);
+            pending.clear();
+        }
+        const size_t whole = num_samples / unit * unit;
+        run(pcm, whole, out);
+        pending.assign(pcm + whole, pcm + num_samples);
+    }
 
-            if (code & 8)
-                state.valprev -= diff;
-            else
-                state.valprev += diff;
+    void finish(std::vector<uint8_t>& out)
+    {
+        run(pending.data(), pending.size(), out);
+        pending.clear();
+    }
 
-            state.valprev = std::clamp(state.valprev, -32768, 32767);
-            state.index += indexTable[code];
-            state.index = std::clamp(state.index, 0, 88);
+private:
+    void run(const int16_t* pcm, size_t num_samples, std::vector<uint8_t>& out)
+    {
+        const size_t at = out.size();
+        out.resize(at + ImaAdpcmEncodedSize(num_samples));
+        ImaAdpcmEncodeChannels(pcm, num_samples, out.data() + at, states.data(), states.size());
+    }
+};
 
-            outBuff[sample_idx++] = static_cast<int16_t>(state.valprev);
+// decode kernels specialized on the channel count, Channels = 0 handles any count given at run time.
+// channel is the channel the next nibble belongs to and is carried between calls
+template <int Channels>
+inline size_t ImaAdpcmDecodeKernel(const uint8_t* samples, size_t num_bytes, int16_t* out, ImaAdpcmState* states, size_t num_channels, size_t& channel)
+{
+    if constexpr (Channels == 1) {
+        ImaAdpcmState state = states[0];
+        for (size_t i = 0; i < num_bytes; ++i) {
+            ImaAdpcmStep(state, samples[i] & 0x0F);
+            *out++ = static_cast<int16_t>(state.valprev);
+            ImaAdpcmStep(state, samples[i] >> 4);
+            *out++ = static_cast<int16_t>(state.valprev);
+        }
+        states[0] = state;
+    }
+    else if constexpr (Channels == 2) {
+        // a byte always holds one nibble per channel, low one first
+        ImaAdpcmState left = states[0], right = states[1];
+        for (size_t i = 0; i < num_bytes; ++i) {
+            ImaAdpcmStep(left, samples[i] & 0x0F);
+            *out++ = static_cast<int16_t>(left.valprev);
+            ImaAdpcmStep(right, samples[i] >> 4);
+            *out++ = static_cast<int16_t>(right.valprev);
+        }
+        states[0] = left;
+        states[1] = right;
+    }
+    else {
+        size_t ch = channel;
+        for (size_t i = 0; i < num_bytes; ++i) {
+            for (int shift = 0; shift <= 4; shift += 4) {
+                ImaAdpcmStep(states[ch], (samples[i] >> shift) & 0x0F);
+                *out++ = static_cast<int16_t>(states[ch].valprev);
+                if (++ch == num_channels)
+                    ch = 0;
+            }
         }
+        channel = ch;
     }
+    return num_bytes * 2;
+}
+
+// incremental decoder, nibbles are interleaved across channels and may be fed in any sized pieces
+struct ImaAdpcmDecoder {
+    static constexpr size_t frame_size = 1;
+
+    std::vector<ImaAdpcmState> states;
+    size_t channel = 0;
+
+    explicit ImaAdpcmDecoder(int num_channels = 1) : states(std::max(num_channels, 1)) {}
+
+    static size_t max_samples(size_t num_bytes) { return num_bytes * 2; }
+    bool done() const { return false; }
 
+    size_t decode(const uint8_t* samples, size_t num_bytes, int16_t* out)
+    {
+        switch (states.size()) {
+            case 1: return ImaAdpcmDecodeKernel<1>(samples, num_bytes, out, states.data(), 1, channel);
+            case 2: return ImaAdpcmDecodeKernel<2>(samples, num_bytes, out, states.data(), 2, channel);
+            default: return ImaAdpcmDecodeKernel<0>(samples, num_bytes, out, states.data(), states.size(), channel);
+        }
+    }
+};
+
+// samples num_bytes decode to, one per nibble
+inline size_t ImaAdpcmDecodedSize(size_t num_bytes) { return num_bytes * 2; }
+
+// one-shot decode with the channel count fixed at compile time, Channels = 0 takes it from num_channels.
+// out needs ImaAdpcmDecodedSize() samples, returns the samples written
+template <int Channels>
+size_t DecodeImaAdpcmChannels(std::span<const uint8_t> samples, std::span<int16_t> out, int num_channels = Channels)
+{
+    if (out.size() < ImaAdpcmDecodedSize(samples.size()))
+        return 0;
+    ImaAdpcmState fixed[Channels ? Channels : 1];
+    std::vector<ImaAdpcmState> states(Channels ? 0 : std::max(num_channels, 1));
+    size_t channel = 0;
+    return ImaAdpcmDecodeKernel<Channels>(samples.data(), samples.size(), out.data(), Channels ? fixed : states.data(),
+                                          Channels ? Channels : states.size(), channel);
+}
+
+size_t DecodeImaAdpcm(std::span<const uint8_t> samples, int num_channels, std::span<int16_t> out)
+{
+    // most entries are IMA, give mono and stereo their own kernels
+    switch (num_channels) {
+        case 1: return DecodeImaAdpcmChannels<1>(samples, out);
+        case 2: return DecodeImaAdpcmChannels<2>(samples, out);
+        default: return DecodeImaAdpcmChannels<0>(samples, out, num_channels);
+    }
+}
+
+std::vector<int16_t> DecodeImaAdpcm(std::span<const uint8_t> samples, int num_channels = 1)
+{
+    std::vector<int16_t> outBuff(ImaAdpcmDecodedSize(samples.size()));
+    DecodeImaAdpcm(samples, num_channels, outBuff);
     return outBuff;
-}
\ No newline at end of file
+}
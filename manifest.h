@@ -0,0 +1,125 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "string_hash_dictionary.h"
+
+// what -e wrote for each track, so -r can tell which WAVs in the folder were edited since.
+// tab separated text after three comment lines:
+//   index  hash  file  size  mtime  content_hash  codec  channels  rate
+// size and mtime are those of the WAV file, content_hash is a ContentHash of its sample data
+struct Manifest {
+    struct Track {
+        int index = -1;
+        uint32_t hash = 0;
+        std::string file;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t content_hash = 0;
+        int codec = 0;
+        int channels = 0;
+        int rate = 0;
+    };
+
+    static constexpr const char* file_name = "manifest.txt";
+
+    // indexed by entry, index -1 marks a track that isn't listed
+    std::vector<Track> tracks;
+
+    // lines for indices at or past num_entries, the bank's entry count, are dropped
+    bool load(const std::filesystem::path& path, size_t num_entries);
+    bool save(const std::filesystem::path& path) const;
+
+    const Track* find(int index) const {
+        return index >= 0 && index < int(tracks.size()) && tracks[index].index == index ? &tracks[index] : nullptr;
+    }
+
+    // false when the file can't be stat'ed
+    static bool stat(const std::filesystem::path& path, uint64_t& size, int64_t& mtime) {
+        std::error_code ec;
+        size = std::filesystem::file_size(path, ec);
+        if (ec)
+            return false;
+        mtime = int64_t(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+        return !ec;
+    }
+};
+
+inline bool Manifest::load(const std::filesystem::path& path, size_t num_entries)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    tracks.assign(num_entries, Track{});
+    std::string line;
+    std::getline(in, line); std::getline(in, line); std::getline(in, line); // skip first 3 lines
+    while (std::getline(in, line)) {
+        skip_newlines(line);
+
+        std::vector<std::string_view> fields;
+        for (size_t pos = 0; pos <= line.size(); ) {
+            size_t tab = line.find('\t', pos);
+            if (tab == std::string::npos)
+                tab = line.size();
+            fields.emplace_back(line.data() + pos, tab - pos);
+            pos = tab + 1;
+        }
+        if (fields.size() != 9)
+            continue;
+
+        auto number = [](std::string_view s, auto& value, int base = 10) {
+            if (base == 16 && s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+                s.remove_prefix(2);
+            auto res = std::from_chars(s.data(), s.data() + s.size(), value, base);
+            return res.ec == std::errc() && res.ptr == s.data() + s.size();
+        };
+
+        Track t;
+        t.file = fields[2];
+        if (!number(fields[0], t.index) || t.index < 0 || !number(fields[1], t.hash, 16) ||
+            !number(fields[3], t.size) || !number(fields[4], t.mtime) || !number(fields[5], t.content_hash, 16) ||
+            !number(fields[6], t.codec) || !number(fields[7], t.channels) || !number(fields[8], t.rate) ||
+            size_t(t.index) >= num_entries)
+            continue;
+
+        tracks[t.index] = std::move(t);
+    }
+    return true;
+}
+
+inline bool Manifest::save(const std::filesystem::path& path) const
+{
+    // written aside and renamed so an interrupted run never leaves half a manifest behind
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream out(tmp);
+        if (!out)
+            return false;
+        out << "# wbk_tool manifest\n# index\thash\tfile\tsize\tmtime\tcontent_hash\tcodec\tchannels\trate\n#\n";
+
+        char hash[16], content_hash[24];
+        for (const auto& t : tracks) {
+            if (t.index < 0)
+                continue;
+            snprintf(hash, sizeof hash, "0x%08x", t.hash);
+            snprintf(content_hash, sizeof content_hash, "%016llx", (unsigned long long)t.content_hash);
+            out << t.index << '\t' << hash << '\t' << t.file << '\t' << t.size << '\t' << t.mtime << '\t'
+                << content_hash << '\t' << t.codec << '\t' << t.channels << '\t' << t.rate << '\n';
+        }
+        out.close();
+        if (out.fail())
+            return false;
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+}
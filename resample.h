@@ -0,0 +1,201 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <span>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "wav.h"
+
+// polyphase resampler for 16-bit PCM.
+//
+// in_rate -> out_rate upsamples by L = out_rate / g and downsamples by M = in_rate / g, g being their gcd.
+// output sample n lies at input position n * M / L, and the fractional part of that picks one of L phases
+// of a Kaiser windowed sinc, low passed just under the lower of the two Nyquist rates. each phase is a
+// short FIR normalized to unity gain. a bank only depends on the rate pair, so it is built once and shared.
+class Resampler {
+public:
+    struct FilterBank {
+        size_t phases;      // L
+        size_t step;        // M
+        size_t taps;        // per phase, a multiple of lanes
+        std::vector<float> coeffs;      // phases * taps, phase by phase
+    };
+
+    // taps accumulated side by side, so the dot product vectorizes without reordering the float sums
+    static constexpr size_t lanes = 8;
+    static constexpr size_t base_taps = 32;     // widened when downsampling to keep the transition band as narrow
+    static constexpr size_t max_taps = 128;
+    static constexpr double kaiser_beta = 8.0;
+    static constexpr double passband = 0.92;    // cutoff as a fraction of the lower Nyquist rate
+
+    // both rates above 0
+    Resampler(uint32_t in_rate, uint32_t out_rate) : bank(filter_bank(in_rate, out_rate)) {}
+
+    size_t output_frames(size_t in_frames) const { return (in_frames * bank->phases + bank->step - 1) / bank->step; }
+
+    // one channel whose samples are in_stride apart, written out_stride apart; out has room for output_frames()
+    void process(const int16_t* in, size_t in_frames, size_t in_stride, int16_t* out, size_t out_stride) const;
+
+    // interleaved samples, each channel on a thread of its own (num_threads at most).
+    // out needs output_frames() * num_channels samples
+    void process(std::span<const int16_t> pcm, int num_channels, std::span<int16_t> out, unsigned num_threads = 1) const;
+    std::vector<int16_t> process(std::span<const int16_t> pcm, int num_channels, unsigned num_threads = 1) const;
+
+    static std::shared_ptr<const FilterBank> filter_bank(uint32_t in_rate, uint32_t out_rate);
+
+private:
+    static std::shared_ptr<const FilterBank> build(size_t phases, size_t step);
+
+    std::shared_ptr<const FilterBank> bank;
+};
+
+inline std::shared_ptr<const Resampler::FilterBank> Resampler::filter_bank(uint32_t in_rate, uint32_t out_rate)
+{
+    static std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<const FilterBank>> banks;
+    static std::mutex banks_lock;
+
+    const uint32_t g = std::gcd(in_rate, out_rate);
+    const std::pair<uint32_t, uint32_t> key(in_rate / g, out_rate / g);
+
+    std::lock_guard guard(banks_lock);
+    auto& cached = banks[key];
+    if (!cached)
+        cached = build(key.second, key.first);
+    return cached;
+}
+
+inline std::shared_ptr<const Resampler::FilterBank> Resampler::build(size_t phases, size_t step)
+{
+    // zeroth order modified Bessel function, the series converges quickly for the betas used here
+    auto bessel_i0 = [](double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; ++k) {
+            term *= (x / (2 * k)) * (x / (2 * k));
+            sum += term;
+        }
+        return sum;
+    };
+
+    const double ratio = std::min(1.0, double(phases) / double(step));
+    const size_t wanted = size_t(std::ceil(base_taps / ratio));
+    const size_t taps = std::min(max_taps, (wanted + lanes - 1) / lanes * lanes);
+    const double cutoff = passband * ratio;
+    const double half = double(taps) / 2;
+    const double pi = 3.14159265358979323846;
+
+    auto bank = std::make_shared<FilterBank>();
+    bank->phases = phases;
+    bank->step = step;
+    bank->taps = taps;
+    bank->coeffs.resize(phases * taps);
+
+    for (size_t p = 0; p < phases; ++p) {
+        float* c = bank->coeffs.data() + p * taps;
+        double sum = 0;
+        for (size_t k = 0; k < taps; ++k) {
+            // distance from the output position to input sample base - taps / 2 + 1 + k
+            const double d = double(k) - (half - 1) - double(p) / double(phases);
+            const double x = cutoff * d;
+            const double sinc = x == 0 ? 1.0 : std::sin(pi * x) / (pi * x);
+            const double r = d / half;
+            const double window = bessel_i0(kaiser_beta * std::sqrt(std::max(0.0, 1 - r * r))) / bessel_i0(kaiser_beta);
+            c[k] = float(sinc * window);
+            sum += c[k];
+        }
+        for (size_t k = 0; k < taps; ++k)
+            c[k] = float(c[k] / sum);
+    }
+    return bank;
+}
+
+inline void Resampler::process(const int16_t* in, size_t in_frames, size_t in_stride, int16_t* out, size_t out_stride) const
+{
+    const size_t taps = bank->taps;
+    const size_t phases = bank->phases;
+    const size_t step = bank->step;
+
+    // the channel as floats with silence either side, so every window is a plain contiguous read.
+    // the last output may sit up to step / phases samples past the end
+    std::vector<float> x(in_frames + 2 * taps + step / phases + 2, 0.0f);
+    for (size_t i = 0; i < in_frames; ++i)
+        x[taps + i] = float(in[i * in_stride]);
+
+    const size_t count = output_frames(in_frames);
+    for (size_t n = 0; n < count; ++n) {
+        const uint64_t pos = uint64_t(n) * step;
+        const size_t base = size_t(pos / phases);
+        const float* c = bank->coeffs.data() + size_t(pos % phases) * taps;
+        const float* window = x.data() + base + taps / 2 + 1;
+
+        float acc[lanes] = {};
+        for (size_t k = 0; k < taps; k += lanes)
+            for (size_t j = 0; j < lanes; ++j)
+                acc[j] += c[k + j] * window[k + j];
+
+        float sum = 0;
+        for (size_t j = 0; j < lanes; ++j)
+            sum += acc[j];
+        out[n * out_stride] = int16_t(std::clamp(std::lrint(sum), -32768L, 32767L));
+    }
+}
+
+inline void Resampler::process(std::span<const int16_t> pcm, int num_channels, std::span<int16_t> out, unsigned num_threads) const
+{
+    const size_t channels = size_t(std::max(num_channels, 1));
+    const size_t in_frames = pcm.size() / channels;
+    if (out.size() < output_frames(in_frames) * channels)
+        return;
+
+    // channels land interleaved, so the threads write disjoint samples of the same buffer
+    const size_t runs = std::max<size_t>(1, std::min<size_t>(num_threads, channels));
+    auto run = [&](size_t first) {
+        for (size_t ch = first; ch < channels; ch += runs)
+            process(pcm.data() + ch, in_frames, channels, out.data() + ch, channels);
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < runs; ++t)
+        threads.emplace_back(run, t);
+    run(0);
+    for (auto& t : threads)
+        t.join();
+}
+
+inline std::vector<int16_t> Resampler::process(std::span<const int16_t> pcm, int num_channels, unsigned num_threads) const
+{
+    const size_t channels = size_t(std::max(num_channels, 1));
+    std::vector<int16_t> out(output_frames(pcm.size() / channels) * channels);
+    process(pcm, num_channels, out, num_threads);
+    return out;
+}
+
+// a copy of wav at rate, header included; rates that already match are copied as they are
+inline WAV ResampleWav(const WAV& wav, uint32_t rate, unsigned num_threads = 1)
+{
+    WAV res;
+    res.header = wav.header;
+    if (rate == 0 || wav.header.sampleRate == 0 || rate == wav.header.sampleRate) {
+        res.samples = wav.samples;
+        return res;
+    }
+
+    const Resampler resampler(wav.header.sampleRate, rate);
+    const size_t channels = std::max<size_t>(wav.header.numChannels, 1);
+    const std::span<const int16_t> pcm(reinterpret_cast<const int16_t*>(wav.samples.data()), wav.samples.size() / 2);
+    const size_t num_samples = resampler.output_frames(pcm.size() / channels) * channels;
+
+    // straight into the WAV's bytes, the samples are little endian on every target
+    res.samples.resize(num_samples * sizeof(int16_t));
+    resampler.process(pcm, wav.header.numChannels, std::span<int16_t>(reinterpret_cast<int16_t*>(res.samples.data()), num_samples), num_threads);
+    res.header.sampleRate = rate;
+    res.header.byteRate = rate * res.header.blockAlign;
+    res.header.subchunk2Size = uint32_t(res.samples.size());
+    return res;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// sample formats WAV files come in, all converted to the 16-bit PCM the encoders take
+enum class SampleFormat { UInt8, Int16, Int24, Int32, Float32, Float64, Unsupported };
+
+// audioFormat 1 is integer PCM, 3 IEEE float; WAVE_FORMAT_EXTENSIBLE carries one of the two in its sub format
+inline SampleFormat GetSampleFormat(int audioFormat, int bitsPerSample)
+{
+    if (audioFormat == 1) {
+        switch (bitsPerSample) {
+            case 8: return SampleFormat::UInt8;
+            case 16: return SampleFormat::Int16;
+            case 24: return SampleFormat::Int24;
+            case 32: return SampleFormat::Int32;
+        }
+    }
+    else if (audioFormat == 3) {
+        switch (bitsPerSample) {
+            case 32: return SampleFormat::Float32;
+            case 64: return SampleFormat::Float64;
+        }
+    }
+    return SampleFormat::Unsupported;
+}
+
+inline size_t SampleFormatBytes(SampleFormat format)
+{
+    switch (format) {
+        case SampleFormat::UInt8: return 1;
+        case SampleFormat::Int16: return 2;
+        case SampleFormat::Int24: return 3;
+        case SampleFormat::Int32: return 4;
+        case SampleFormat::Float32: return 4;
+        case SampleFormat::Float64: return 8;
+        default: return 0;
+    }
+}
+
+// triangular (TPDF) dither of +-1 LSB: the difference of two uniform values, both taken from a hash of the
+// sample's index so a file dithers the same however it is cut up, and every lane is independent of the others
+inline float TpdfDither(uint32_t index)
+{
+    uint32_t h = index * 0x9E3779B1u;
+    h ^= h >> 15;
+    h *= 0x85EBCA77u;
+    h ^= h >> 13;
+    return float(int32_t(h & 0xFFFF) - int32_t(h >> 16)) * (1.0f / 65536.0f);
+}
+
+// load(i) returns sample i scaled to 16-bit range; rounded and clamped into out. written as straight loops over
+// independent samples with min/max instead of branches so they vectorize. NaN comes out as -32768.
+// the arithmetic is done in whatever type load returns, float unless the source needs more precision
+template <bool Dither, class Load>
+inline void ConvertScaledToInt16(size_t count, int16_t* out, size_t first_index, Load&& load)
+{
+    using T = decltype(load(size_t(0)));
+    for (size_t i = 0; i < count; ++i) {
+        T x = load(i);
+        if constexpr (Dither)
+            x += T(TpdfDither(uint32_t(first_index + i)));
+        x = std::min(T(32767), std::max(T(-32768), x));
+        out[i] = int16_t(int32_t(x + (x >= 0 ? T(0.5) : T(-0.5))));
+    }
+}
+
+template <bool Dither>
+inline void ConvertToInt16(const uint8_t* src, SampleFormat format, size_t count, int16_t* out, size_t first_index)
+{
+    switch (format) {
+        case SampleFormat::UInt8:       // widening, nothing to dither
+            for (size_t i = 0; i < count; ++i)
+                out[i] = int16_t((int32_t(src[i]) - 128) * 256);
+            break;
+        case SampleFormat::Int16:
+            std::memcpy(out, src, count * sizeof(int16_t));
+            break;
+        case SampleFormat::Int24:
+            ConvertScaledToInt16<Dither>(count, out, first_index, [src](size_t i) {
+                const uint8_t* p = src + 3 * i;
+                return float(int32_t(uint32_t(p[0]) << 8 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 24) >> 8) * (1.0f / 256.0f);
+            });
+            break;
+        case SampleFormat::Int32:
+            // a float only holds 24 bits, so the top 16 are rounded off in integers, or scaled in double to dither
+            if constexpr (Dither) {
+                ConvertScaledToInt16<true>(count, out, first_index, [src](size_t i) {
+                    int32_t v;
+                    std::memcpy(&v, src + 4 * i, sizeof v);
+                    return double(v) * (1.0 / 65536.0);
+                });
+            }
+            else {
+                for (size_t i = 0; i < count; ++i) {
+                    int32_t v;
+                    std::memcpy(&v, src + 4 * i, sizeof v);
+                    // half away from zero like the float paths, only the top can overflow
+                    out[i] = int16_t(std::min<int64_t>(32767, (int64_t(v) + 0x8000 - (v < 0)) >> 16));
+                }
+            }
+            break;
+        case SampleFormat::Float32:
+            ConvertScaledToInt16<Dither>(count, out, first_index, [src](size_t i) {
+                float v;
+                std::memcpy(&v, src + 4 * i, sizeof v);
+                return v * 32768.0f;
+            });
+            break;
+        case SampleFormat::Float64:
+            ConvertScaledToInt16<Dither>(count, out, first_index, [src](size_t i) {
+                double v;
+                std::memcpy(&v, src + 8 * i, sizeof v);
+                return float(v * 32768.0);
+            });
+            break;
+        default:
+            std::fill_n(out, count, int16_t(0));
+            break;
+    }
+}
+
+// converts count little endian samples of format at src to int16. first_index is the position of src[0] in the
+// whole stream, which keeps the dither the same when a file is converted in chunks
+inline void ConvertToInt16(const uint8_t* src, SampleFormat format, size_t count, int16_t* out, bool dither = false, size_t first_index = 0)
+{
+    if (dither)
+        ConvertToInt16<true>(src, format, count, out, first_index);
+    else
+        ConvertToInt16<false>(src, format, count, out, first_index);
+}
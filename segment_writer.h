@@ -0,0 +1,140 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#ifdef _WIN32
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <limits.h>
+#   include <sys/uio.h>
+#   include <unistd.h>
+#endif
+
+// describes a file as an ordered list of byte ranges and streams them out without joining them first
+class SegmentWriter {
+public:
+    // the range must stay valid until write() returns
+    void add(std::span<const uint8_t> bytes) {
+        if (!bytes.empty())
+            segments.push_back(bytes);
+    }
+
+    // the writer keeps the buffer alive itself
+    void add(std::vector<uint8_t>&& bytes) {
+        owned.push_back(std::move(bytes));
+        add(std::span<const uint8_t>(owned.back()));
+    }
+
+    void add_zeros(size_t count) {
+        for (; count; ) {
+            const size_t n = std::min(count, sizeof zero_page);
+            add(std::span<const uint8_t>(zero_page, n));
+            count -= n;
+        }
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& seg : segments)
+            total += seg.size();
+        return total;
+    }
+
+    const std::vector<std::span<const uint8_t>>& parts() const { return segments; }
+
+    // concatenates everything in memory, for callers that want the result as a buffer
+    std::vector<uint8_t> gather() const {
+        std::vector<uint8_t> out;
+        out.reserve(size());
+        for (const auto& seg : segments)
+            out.insert(out.end(), seg.begin(), seg.end());
+        return out;
+    }
+
+    // on_written is called with each range once it is on its way to disk, e.g. to drop mapped pages
+    template <class OnWritten>
+    bool write(const std::filesystem::path& path, OnWritten&& on_written) const;
+    bool write(const std::filesystem::path& path) const { return write(path, [](std::span<const uint8_t>) {}); }
+
+private:
+    static inline const uint8_t zero_page[0x8000] = {};
+
+    std::vector<std::span<const uint8_t>> segments;
+    std::deque<std::vector<uint8_t>> owned;
+};
+
+template <class OnWritten>
+bool SegmentWriter::write(const std::filesystem::path& path, OnWritten&& on_written) const
+{
+#ifdef _WIN32
+    // WriteFileGather wants page sized, unbuffered pieces, so go range by range
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    bool ok = true;
+    for (const auto& seg : segments) {
+        for (size_t done = 0; ok && done < seg.size(); ) {
+            const DWORD n = DWORD(std::min<size_t>(seg.size() - done, 1u << 30));
+            DWORD written = 0;
+            ok = WriteFile(file, seg.data() + done, n, &written, nullptr) && written > 0;
+            done += written;
+        }
+        if (!ok)
+            break;
+        on_written(seg);
+    }
+    return CloseHandle(file) && ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    constexpr size_t max_iov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+    std::vector<iovec> iov;
+    iov.reserve(max_iov);
+
+    bool ok = true;
+    for (size_t first = 0; ok && first < segments.size(); first += max_iov) {
+        const size_t count = std::min(max_iov, segments.size() - first);
+        iov.clear();
+        for (size_t i = 0; i < count; ++i)
+            iov.push_back({ const_cast<uint8_t*>(segments[first + i].data()), segments[first + i].size() });
+
+        // writev may stop part way, pick up from wherever it got to
+        for (iovec* cur = iov.data(), *end = iov.data() + iov.size(); ok && cur != end; ) {
+            ssize_t written = ::writev(fd, cur, int(end - cur));
+            if (written < 0) {
+                ok = errno == EINTR;
+                continue;
+            }
+            while (cur != end && size_t(written) >= cur->iov_len) {
+                written -= ssize_t(cur->iov_len);
+                ++cur;
+            }
+            if (cur != end) {
+                cur->iov_base = static_cast<uint8_t*>(cur->iov_base) + written;
+                cur->iov_len -= size_t(written);
+            }
+        }
+
+        for (size_t i = 0; ok && i < count; ++i)
+            on_written(segments[first + i]);
+    }
+    return ::close(fd) == 0 && ok;
+#endif
+}
@@ -0,0 +1,310 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mapped_file.h"
+
+// ------
+struct string_hash {
+    int hash;
+    string_hash(int h) : hash(h) {}
+    static constexpr inline std::uint32_t to_hash(const char* str) {
+        std::uint32_t res = 0;
+
+        for (int c = *str; c != '\0'; ++str, c = *str) {
+            int ch_lower = [](auto c) -> int {
+                if (isalpha(c))
+                    return tolower(c);
+                return c;
+                }(c);
+            res = ch_lower + 33 * res;
+        }
+
+        return res;
+    }
+    static constexpr inline std::uint32_t to_hash(std::string_view str) {
+        std::uint32_t res = 0;
+        for (char c : str) {
+            if (c == '\0')
+                break;
+            res = (isalpha(c) ? tolower(c) : int(c)) + 33 * res;
+        }
+        return res;
+    }
+};
+
+static inline void skip_newlines(std::string& s) {
+    while (!s.empty() && (s.back() == '\r' || s.back() == '\n')) s.pop_back();
+}
+
+// hash -> name table, either parsed from string_hash_dictionary.txt or mapped from its compiled form.
+//
+// compiled layout, all little endian:
+//   file_header_t
+//   record_t[count]        sorted by hash
+//   reverse_t[count]       sorted by to_hash(name), the name -> hash index
+//   char pool[pool_size]   names, each followed by a '\0'
+class StringHashDictionary {
+public:
+#pragma pack(push, 1)
+    struct file_header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+        uint32_t pool_size;
+        uint32_t mismatches;    // names whose to_hash() isn't their key
+    };
+    struct record_t {
+        uint32_t hash;
+        uint32_t name_offs;
+        uint32_t name_len;
+    };
+    struct reverse_t {
+        uint32_t name_hash;
+        uint32_t record;
+    };
+#pragma pack(pop)
+
+    static constexpr char magic[8] = { 'W', 'B', 'K', 'D', 'I', 'C', 'T', '\0' };
+    static constexpr uint32_t version = 1;
+
+    bool load_text(const std::filesystem::path& path);
+    bool load_compiled(const std::filesystem::path& path);
+    bool save_compiled(const std::filesystem::path& path) const;
+
+    // empty when the hash is unknown; points into the dictionary, no copy
+    std::string_view find(uint32_t hash) const;
+    // the key stored for a name, matched case-insensitively like to_hash()
+    std::optional<uint32_t> find(std::string_view name) const;
+
+    size_t size() const { return records.size(); }
+    size_t mismatches() const { return num_mismatches; }
+
+private:
+    std::string_view name_of(const record_t& rec) const { return { pool.data() + rec.name_offs, rec.name_len }; }
+    void build_reverse_index();
+
+    // views into either the mapping or the owned_* buffers below
+    std::span<const record_t> records;
+    std::span<const reverse_t> reverse;
+    std::span<const char> pool;
+    size_t num_mismatches = 0;
+
+    MappedFile file;
+    std::vector<record_t> owned_records;
+    std::vector<reverse_t> owned_reverse;
+    std::vector<char> owned_pool;
+};
+
+inline bool StringHashDictionary::load_text(const std::filesystem::path& path)
+{
+    std::ifstream in(path);
+    if (!in) return false;
+
+    owned_records.clear();
+    owned_pool.clear();
+
+    std::string line;
+    std::getline(in, line); std::getline(in, line); std::getline(in, line); // skip first 3 lines
+    while (std::getline(in, line)) {
+        skip_newlines(line);
+        if (line.empty()) continue;
+
+        const auto tab_pos = line.find('\t');
+        if (tab_pos == std::string::npos) continue;
+
+        const std::string_view prefix(line.c_str(), tab_pos);
+        if (prefix.size() < 3 || prefix[0] != '0' || (prefix[1] != 'x' && prefix[1] != 'X')) continue;
+
+        uint32_t key = 0;
+        const char* first = line.c_str() + 2;
+        const char* last = line.c_str() + tab_pos; // up to tab
+        auto res = std::from_chars(first, last, key, 16);
+        if (res.ec != std::errc() || res.ptr != last) continue;
+
+        std::string_view value(line.c_str() + tab_pos + 1, line.size() - tab_pos - 1);
+        owned_records.push_back({ key, uint32_t(owned_pool.size()), uint32_t(value.size()) });
+        owned_pool.insert(owned_pool.end(), value.begin(), value.end());
+        owned_pool.push_back('\0');
+    }
+
+    // first definition of a hash wins
+    std::stable_sort(owned_records.begin(), owned_records.end(), [](const record_t& a, const record_t& b) { return a.hash < b.hash; });
+    owned_records.erase(std::unique(owned_records.begin(), owned_records.end(), [](const record_t& a, const record_t& b) { return a.hash == b.hash; }),
+                        owned_records.end());
+
+    file.close();
+    records = owned_records;
+    pool = owned_pool;
+    build_reverse_index();
+    return true;
+}
+
+inline void StringHashDictionary::build_reverse_index()
+{
+    owned_reverse.clear();
+    owned_reverse.reserve(records.size());
+    num_mismatches = 0;
+
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        const uint32_t name_hash = string_hash::to_hash(name_of(records[i]));
+        if (name_hash != records[i].hash)
+            ++num_mismatches;
+        owned_reverse.push_back({ name_hash, i });
+    }
+    std::sort(owned_reverse.begin(), owned_reverse.end(), [](const reverse_t& a, const reverse_t& b) {
+        return a.name_hash != b.name_hash ? a.name_hash < b.name_hash : a.record < b.record;
+    });
+    reverse = owned_reverse;
+}
+
+inline bool StringHashDictionary::save_compiled(const std::filesystem::path& path) const
+{
+    file_header_t hdr{};
+    std::memcpy(hdr.magic, magic, sizeof magic);
+    hdr.version = version;
+    hdr.count = uint32_t(records.size());
+    hdr.pool_size = uint32_t(pool.size());
+    hdr.mismatches = uint32_t(num_mismatches);
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&hdr), sizeof hdr);
+    out.write(reinterpret_cast<const char*>(records.data()), records.size_bytes());
+    out.write(reinterpret_cast<const char*>(reverse.data()), reverse.size_bytes());
+    out.write(pool.data(), pool.size());
+    out.close();
+    return !out.fail();
+}
+
+inline bool StringHashDictionary::load_compiled(const std::filesystem::path& path)
+{
+    MappedFile mapped;
+    if (!mapped.open(path) || mapped.size() < sizeof(file_header_t))
+        return false;
+
+    file_header_t hdr;
+    std::memcpy(&hdr, mapped.data(), sizeof hdr);
+    const size_t expected = sizeof hdr + size_t(hdr.count) * (sizeof(record_t) + sizeof(reverse_t)) + hdr.pool_size;
+    if (std::memcmp(hdr.magic, magic, sizeof magic) != 0 || hdr.version != version || mapped.size() < expected)
+        return false;
+
+    const uint8_t* base = mapped.data() + sizeof hdr;
+    const std::span<const record_t> mapped_records{ reinterpret_cast<const record_t*>(base), hdr.count };
+    const std::span<const reverse_t> mapped_reverse{ reinterpret_cast<const reverse_t*>(base + mapped_records.size_bytes()), hdr.count };
+
+    // a truncated or hand-edited file mustn't point outside the pool or the records, the caller falls back to the text
+    for (const record_t& rec : mapped_records) {
+        if (uint64_t(rec.name_offs) + rec.name_len > hdr.pool_size)
+            return false;
+    }
+    for (const reverse_t& rev : mapped_reverse) {
+        if (rev.record >= hdr.count)
+            return false;
+    }
+
+    records = mapped_records;
+    reverse = mapped_reverse;
+    pool = { reinterpret_cast<const char*>(base + mapped_records.size_bytes() + mapped_reverse.size_bytes()), hdr.pool_size };
+    num_mismatches = hdr.mismatches;
+
+    file = std::move(mapped);
+    owned_records.clear();
+    owned_reverse.clear();
+    owned_pool.clear();
+    return true;
+}
+
+inline std::string_view StringHashDictionary::find(uint32_t hash) const
+{
+    auto it = std::lower_bound(records.begin(), records.end(), hash, [](const record_t& r, uint32_t h) { return r.hash < h; });
+    if (it != records.end() && it->hash == hash)
+        return name_of(*it);
+    return {};
+}
+
+inline std::optional<uint32_t> StringHashDictionary::find(std::string_view name) const
+{
+    const uint32_t name_hash = string_hash::to_hash(name);
+    auto it = std::lower_bound(reverse.begin(), reverse.end(), name_hash, [](const reverse_t& r, uint32_t h) { return r.name_hash < h; });
+    for (; it != reverse.end() && it->name_hash == name_hash; ++it) {
+        const record_t& rec = records[it->record];
+        const std::string_view candidate = name_of(rec);
+        if (candidate.size() == name.size() &&
+            std::equal(candidate.begin(), candidate.end(), name.begin(), [](char a, char b) { return tolower(a) == tolower(b); }))
+            return rec.hash;
+    }
+    return std::nullopt;
+}
+
+// prefers the compiled dictionary, unless the text one has been edited since it was compiled or the compiled one
+// doesn't validate
+static const StringHashDictionary& get_string_hash_dictionary() {
+    static StringHashDictionary dict;
+    static std::once_flag loaded_once;
+    std::call_once(loaded_once, [] {
+        const std::filesystem::path text_path = "string_hash_dictionary.txt";
+        const std::filesystem::path compiled_path = "string_hash_dictionary.bin";
+
+        std::error_code ec;
+        const bool has_text = std::filesystem::exists(text_path, ec);
+        const bool stale = has_text && std::filesystem::exists(compiled_path, ec) &&
+                           std::filesystem::last_write_time(text_path, ec) > std::filesystem::last_write_time(compiled_path, ec);
+        if (!stale && dict.load_compiled(compiled_path))
+            return;
+        if (has_text)
+            dict.load_text(text_path);
+        });
+    return dict;
+}
+
+// empty when unknown, points into the dictionary, which lives as long as the process
+inline std::string_view lookup_string_by_hash(uint32_t hash) {
+    return get_string_hash_dictionary().find(hash);
+}
+
+inline std::optional<uint32_t> lookup_hash_by_string(std::string_view name) {
+    return get_string_hash_dictionary().find(name);
+}
+
+// adds names to the text dictionary, starting a new one (with the three skipped header lines) if needed
+inline bool append_to_string_hash_dictionary(const std::filesystem::path& text_path, std::span<const std::pair<uint32_t, std::string>> names) {
+    std::error_code ec;
+    const bool existed = std::filesystem::exists(text_path, ec);
+
+    std::ofstream out(text_path, std::ios::app);
+    if (!out) return false;
+    if (!existed)
+        out << "# string hash dictionary\n# hash\tname\n#\n";
+
+    char key[16];
+    for (const auto& [hash, name] : names) {
+        snprintf(key, sizeof key, "0x%08x", hash);
+        out << key << '\t' << name << '\n';
+    }
+    out.close();
+    return !out.fail();
+}
+
+// turns the text dictionary into the mappable form, returns the number of entries or -1
+inline long long compile_string_hash_dictionary(const std::filesystem::path& text_path, const std::filesystem::path& compiled_path) {
+    StringHashDictionary dict;
+    if (!dict.load_text(text_path) || !dict.save_compiled(compiled_path))
+        return -1;
+    if (dict.mismatches())
+        printf("Warning: %zu names don't hash to their key\n", dict.mismatches());
+    return (long long)dict.size();
+}
+// ------
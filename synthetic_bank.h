@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "segment_writer.h"
+#include "wav.h"
+#include "wbk.h"
+
+// deterministic material for benchmarks and scale tests. integer arithmetic only, so a seed gives the same
+// bytes with every compiler and standard library (<random>'s distributions and libm's sin() don't promise that)
+
+// splitmix64
+struct SyntheticRng {
+    uint64_t state;
+
+    explicit SyntheticRng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // in [0, n)
+    uint32_t below(uint32_t n) { return uint32_t(((next() >> 32) * n) >> 32); }
+    // in [lo, hi]
+    size_t between(size_t lo, size_t hi) { return hi > lo ? lo + size_t(next() % (hi - lo + 1)) : lo; }
+};
+
+// a parabola per half period, close enough to a sine for codec work. phase runs over the full 32 bits
+inline int32_t SyntheticSine(uint32_t phase)
+{
+    const int32_t x = int32_t(phase >> 16) - 32768;            // -32768..32767, 0 at half a period
+    const int32_t a = x < 0 ? -x : x;
+    return -int32_t((int64_t(4) * x * (32768 - a)) >> 15);     // -32768..32768
+}
+
+// three gliding tones per channel under a little noise, interleaved. loud and busy enough to take the
+// encoders through their whole range of step sizes
+inline std::vector<int16_t> SyntheticPcm(uint64_t seed, size_t frames, int num_channels)
+{
+    const size_t channels = size_t(std::max(num_channels, 1));
+    SyntheticRng rng(seed);
+
+    struct Voice { uint32_t phase, step, glide; int32_t level; };
+    std::vector<Voice> voices(channels * 3);
+    for (auto& v : voices) {
+        v.phase = uint32_t(rng.next());
+        v.step = 0x00200000u + rng.below(0x04000000u);         // roughly 20 Hz .. 2.7 kHz at 44.1 kHz
+        v.glide = rng.below(0x80u);
+        v.level = 4000 + int32_t(rng.below(6000));
+    }
+
+    std::vector<int16_t> pcm(frames * channels);
+    for (size_t i = 0; i < frames; ++i) {
+        for (size_t ch = 0; ch < channels; ++ch) {
+            int32_t sum = int32_t(rng.below(1024)) - 512;
+            for (size_t k = 0; k < 3; ++k) {
+                Voice& v = voices[ch * 3 + k];
+                sum += int32_t((int64_t(SyntheticSine(v.phase)) * v.level) >> 15);
+                v.phase += v.step;
+                v.step += v.glide;
+            }
+            pcm[i * channels + ch] = int16_t(std::clamp(sum, -32768, 32767));
+        }
+    }
+    return pcm;
+}
+
+inline WAV SyntheticWav(uint64_t seed, size_t frames, int num_channels, uint32_t rate)
+{
+    const std::vector<int16_t> pcm = SyntheticPcm(seed, frames, num_channels);
+
+    WAV wav;
+    wav.header.numChannels = uint16_t(std::max(num_channels, 1));
+    wav.header.sampleRate = rate;
+    wav.header.blockAlign = uint16_t(2 * wav.header.numChannels);
+    wav.header.byteRate = rate * wav.header.blockAlign;
+    wav.header.subchunk2Size = uint32_t(pcm.size() * sizeof(int16_t));
+    wav.header.chunkSize = 36 + wav.header.subchunk2Size;
+    wav.samples.resize(pcm.size() * sizeof(int16_t));
+    std::memcpy(wav.samples.data(), pcm.data(), wav.samples.size());
+    return wav;
+}
+
+struct SyntheticBankSpec {
+    uint64_t seed = 1;
+    int num_entries = 16;
+    std::vector<WBK::Codec> codecs = { WBK::ADPCM_1, WBK::ADPCM_2, WBK::IMA_ADPCM };
+    std::vector<unsigned> codec_weights;    // one per codec, drawn at random by weight; empty takes the codecs in turn
+    size_t min_frames = 1000;       // track lengths are drawn from [min_frames, max_frames], evenly
+    size_t max_frames = 50000;
+    bool log_lengths = false;       // or evenly per octave, so mostly short effects and the odd long track
+    int max_channels = 2;           // up to 8, one flags bit each
+    size_t target_bytes = 0;        // payload slots are padded out until the bank is about this big
+    std::vector<uint32_t> rates = { 22050, 32000, 44100 };
+    Adpcm1Encoder::Preset adpcm1_preset = Adpcm1Encoder::Fast;
+    std::string_view name = "synthetic";
+    std::string_view group = "SFX";
+};
+
+// the largest bank parse() accepts, total_bytes is an int and INT_MAX itself is refused
+static constexpr size_t synthetic_bank_max_bytes = size_t(INT_MAX) & ~size_t(0x7FFF);
+
+inline WBK::Codec PickSyntheticCodec(const SyntheticBankSpec& spec, int index, SyntheticRng& rng)
+{
+    if (spec.codecs.empty())
+        return WBK::IMA_ADPCM;
+    if (spec.codec_weights.size() != spec.codecs.size())
+        return spec.codecs[index % spec.codecs.size()];
+
+    uint32_t total = 0;
+    for (unsigned w : spec.codec_weights)
+        total += w;
+    uint32_t pick = rng.below(std::max(total, 1u));
+    for (size_t k = 0; k < spec.codecs.size(); ++k) {
+        if (pick < spec.codec_weights[k])
+            return spec.codecs[k];
+        pick -= spec.codec_weights[k];
+    }
+    return spec.codecs.back();
+}
+
+inline size_t PickSyntheticLength(const SyntheticBankSpec& spec, SyntheticRng& rng)
+{
+    const size_t hi = std::max(spec.min_frames, spec.max_frames);
+    if (!spec.log_lengths)
+        return rng.between(spec.min_frames, hi);
+
+    // an octave first, then a length within it
+    const size_t lo = std::max<size_t>(spec.min_frames, 1);
+    size_t octaves = 0;
+    while ((lo << (octaves + 1)) <= hi)
+        ++octaves;
+    const size_t first = lo << rng.between(0, octaves);
+    return rng.between(first, std::min(hi, 2 * first - 1));
+}
+
+// a bank laid out the way the game's are: header_t, the nslWave table, one metadata_t per codec in use, the
+// bank group, then every payload encoded from SyntheticPcm() and aligned to 0x8000. the payloads are owned
+// by out, the padding is its shared zero page. false when the bank would grow past synthetic_bank_max_bytes
+inline bool BuildSyntheticBank(const SyntheticBankSpec& spec, SegmentWriter& out)
+{
+    SyntheticRng rng(spec.seed);
+    WBK encoder;
+    encoder.set_adpcm1_preset(spec.adpcm1_preset);
+
+    const int num_entries = std::max(spec.num_entries, 0);
+    std::vector<WBK::nslWave> entries(num_entries);
+    std::vector<std::vector<uint8_t>> payloads(num_entries);
+
+    for (int i = 0; i < num_entries; ++i) {
+        WBK::nslWave& e = entries[i];
+        std::memset(&e, 0, sizeof e);
+        e.hash = int(uint32_t(rng.next()));
+        e.codec = PickSyntheticCodec(spec, i, rng);
+        e.samples_per_second = static_cast<unsigned short>(spec.rates.empty() ? 32000 : spec.rates[rng.below(uint32_t(spec.rates.size()))]);
+
+        const int channels = 1 + int(rng.below(uint32_t(std::clamp(spec.max_channels, 1, 8))));
+        WBK::SetNumChannels(e, channels);
+
+        const size_t frames = PickSyntheticLength(spec, rng);
+        const std::vector<int16_t> pcm = SyntheticPcm(rng.next(), frames, channels);
+        payloads[i].resize(WBK::encoded_size(pcm.size(), channels, e.codec));
+        payloads[i].resize(encoder.encode(pcm, channels, e.codec, payloads[i]));
+        e.num_bytes = static_cast<unsigned>(payloads[i].size());
+        e.num_samples = int(frames);
+    }
+
+    std::vector<WBK::Codec> used;
+    for (const auto& e : entries) {
+        if (std::find(used.begin(), used.end(), e.codec) == used.end())
+            used.push_back(e.codec);
+    }
+
+    WBK::header_t header;
+    std::memset(&header, 0, sizeof header);
+    std::memcpy(header.magic, "WBKAUDIO", 8);
+    std::memcpy(header.name, spec.name.data(), std::min(spec.name.size(), sizeof(header.name) - 1));
+    header.num_entries = num_entries;
+    header.metadata_offs = int(sizeof WBK::header_t + sizeof WBK::nslWave * size_t(num_entries));
+    header.entry_desc_offs = header.metadata_offs + int(sizeof WBK::metadata_t * used.size());
+
+    const size_t table_size = size_t(header.entry_desc_offs) + 16;
+    const size_t first = (table_size + 0x7FFF) & ~size_t(0x7FFF);
+    header.sample_data_offs = int(first);
+
+    // slot sizes, then whatever target_bytes asks for on top spread evenly over them
+    std::vector<size_t> slots(num_entries);
+    size_t natural = first;
+    for (int i = 0; i < num_entries; ++i) {
+        slots[i] = (payloads[i].size() + 0x7FFF) & ~size_t(0x7FFF);
+        natural += slots[i];
+    }
+    const size_t target = std::min(spec.target_bytes, synthetic_bank_max_bytes);
+    if (num_entries && target > natural) {
+        const size_t pages = (target - natural) / 0x8000;
+        for (int i = 0; i < num_entries; ++i)
+            slots[i] += 0x8000 * (pages / num_entries + (size_t(i) < pages % num_entries));
+    }
+
+    size_t offset = first;
+    for (int i = 0; i < num_entries; ++i) {
+        entries[i].compressed_data_offs = int(std::min(offset, synthetic_bank_max_bytes));
+        offset += slots[i];
+    }
+    if (offset > synthetic_bank_max_bytes)
+        return false;
+    header.total_bytes = int(offset);
+
+    std::vector<uint8_t> table(table_size, 0);
+    std::memcpy(table.data(), &header, sizeof header);
+    if (num_entries)
+        std::memcpy(table.data() + sizeof header, entries.data(), sizeof WBK::nslWave * entries.size());
+    for (size_t k = 0; k < used.size(); ++k) {
+        WBK::metadata_t meta;
+        std::memset(&meta, 0, sizeof meta);
+        meta.codec = used[k];
+        std::fill_n(meta.unk_fvals, 6, 1.0f);
+        std::memcpy(table.data() + header.metadata_offs + sizeof meta * k, &meta, sizeof meta);
+    }
+    std::memcpy(table.data() + header.entry_desc_offs, spec.group.data(), std::min<size_t>(spec.group.size(), 15));
+
+    out.add(std::move(table));
+    out.add_zeros(first - table_size);
+    for (int i = 0; i < num_entries; ++i) {
+        const size_t size = payloads[i].size();
+        out.add(std::move(payloads[i]));
+        out.add_zeros(slots[i] - size);
+    }
+    return true;
+}
+
+// empty when the bank is too big
+inline std::vector<uint8_t> BuildSyntheticBank(const SyntheticBankSpec& spec)
+{
+    SegmentWriter out;
+    if (!BuildSyntheticBank(spec, out))
+        return {};
+    return out.gather();
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// work-stealing pool: every worker owns a queue and steals from the others once it runs dry. every queue is
+// taken oldest first, by its owner and thieves alike, so tasks start in the order they were submitted and a
+// bulk submission sorted biggest first runs that way. tasks submitted from outside the pool go through a shared queue.
+// the thread calling wait() takes part too, so a pool of N runs N tasks at once on N - 1 extra threads.
+// tasks are expected to catch their own exceptions, anything still thrown is discarded.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned num_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // tasks submitted from inside a task land on that worker's own deque
+    void submit(std::function<void()> task);
+
+    // runs tasks until everything submitted so far, including nested submissions, has finished.
+    // not to be called from inside a task, which would wait on itself
+    void wait();
+
+    unsigned size() const { return unsigned(queues.size()); }
+
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+
+    bool run_one(size_t self);
+    void worker_main(size_t self);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    Queue injected;
+    std::vector<std::thread> threads;
+
+    std::atomic<size_t> queued{ 0 };      // submitted, not yet picked up
+    std::atomic<size_t> unfinished{ 0 };  // submitted, not yet completed
+    std::atomic<bool> stopping{ false };
+
+    std::mutex sleep_lock;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+
+    static inline thread_local const ThreadPool* current_pool = nullptr;
+    static inline thread_local size_t current_queue = 0;
+};
+
+inline ThreadPool::ThreadPool(unsigned num_threads)
+{
+    num_threads = num_threads ? num_threads : 1;
+    for (unsigned i = 0; i < num_threads; ++i)
+        queues.push_back(std::make_unique<Queue>());
+
+    // queue 0 belongs to whoever calls wait()
+    for (unsigned i = 1; i < num_threads; ++i)
+        threads.emplace_back(&ThreadPool::worker_main, this, size_t(i));
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        std::lock_guard guard(sleep_lock);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+inline void ThreadPool::submit(std::function<void()> task)
+{
+    Queue& target = current_pool == this ? *queues[current_queue] : injected;
+
+    // count first so a thief finishing it straight away can't take the counters below zero
+    unfinished++;
+    {
+        std::lock_guard guard(sleep_lock);
+        queued++;
+    }
+    {
+        std::lock_guard guard(target.lock);
+        target.tasks.push_back(std::move(task));
+    }
+    work_available.notify_one();
+    all_done.notify_one();     // lets a thread blocked in wait() help out
+}
+
+inline bool ThreadPool::run_one(size_t self)
+{
+    std::function<void()> task;
+
+    auto take = [&task](Queue& q) {
+        std::lock_guard guard(q.lock);
+        if (q.tasks.empty())
+            return false;
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    };
+
+    // own queue first, then outside submissions, then steal from the others
+    bool found = take(*queues[self]) || take(injected);
+    for (size_t i = 1; i < queues.size() && !found; ++i)
+        found = take(*queues[(self + i) % queues.size()]);
+
+    if (!found)
+        return false;
+
+    queued--;
+    const ThreadPool* prev_pool = std::exchange(current_pool, this);
+    const size_t prev_queue = std::exchange(current_queue, self);
+    // tasks report their own failures. one escaping anyway is dropped, a worker thread throwing would terminate
+    // the process and skipping the count below would leave wait() blocked for good
+    try {
+        task();
+    }
+    catch (...) {
+    }
+    current_pool = prev_pool;
+    current_queue = prev_queue;
+
+    if (--unfinished == 0) {
+        std::lock_guard guard(sleep_lock);
+        all_done.notify_all();
+    }
+    return true;
+}
+
+inline void ThreadPool::worker_main(size_t self)
+{
+    for (;;) {
+        if (run_one(self))
+            continue;
+
+        std::unique_lock guard(sleep_lock);
+        work_available.wait(guard, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+inline void ThreadPool::wait()
+{
+    const size_t self = current_pool == this ? current_queue : 0;
+    while (unfinished > 0) {
+        if (run_one(self))
+            continue;
+
+        // nothing left to steal, the remaining tasks are running elsewhere
+        std::unique_lock guard(sleep_lock);
+        all_done.wait(guard, [this] { return unfinished == 0 || queued > 0; });
+    }
+}
@@ -8,6 +8,8 @@
 #include <stdexcept>
 #include <algorithm>
 #include "ima_adpcm.h"
+#include "content_hash.h"
+#include "sample_convert.h"
 
 struct WAV {
     #pragma pack(push, 1)
@@ -30,56 +32,53 @@ struct WAV {
     std::vector<uint8_t> samples;
 
 
-    bool readWAV(const std::filesystem::path& filename) {
-        std::ifstream f(filename, std::ios::binary);
-        if (!f.good()) return false;
+    // streams the data chunk a block of frames at a time. 8/16/24/32-bit integer, 32/64-bit float and
+    // WAVE_FORMAT_EXTENSIBLE files are accepted, anything but 16-bit is converted to it on the way in
+    // (with TPDF dither when asked to) and info() describes the 16-bit PCM read() hands out
+    class Reader {
+    public:
+        static constexpr size_t block_frames = 4096;     // frames converted per pass, bounds the scratch buffer
+        size_t block_samples() const { return block_frames * channels(); }
 
-        samples.clear();
+        bool open(const std::filesystem::path& filename, bool dither = false);
 
-        char riff[4], wave[4];
-        uint32_t riffSize = 0;
-        if (!f.read(riff, 4) || !f.read(reinterpret_cast<char*>(&riffSize), 4) || !f.read(wave, 4))
-            return false;
-        if (std::string(riff, 4) != "RIFF" || std::string(wave, 4) != "WAVE")
-            return false;
+        const WAVHeader& info() const { return header; }
+        int channels() const { return header.numChannels ? header.numChannels : 1; }
+        // a data chunk may end part way through a frame, those samples are kept
+        size_t samples() const { return total_samples; }
+        size_t frames() const { return total_samples / channels(); }
 
-        bool gotFmt = false, gotData = false;
-        while (f && !(gotFmt && gotData)) {
-            char id[4];
-            uint32_t sz = 0;
-            if (!f.read(id, 4) || !f.read(reinterpret_cast<char*>(&sz), 4)) break;
-
-            if (std::string(id, 4) == "fmt ") {
-                if (sz < 16) return false;
-                f.read(reinterpret_cast<char*>(&header.audioFormat), 2);
-                f.read(reinterpret_cast<char*>(&header.numChannels), 2);
-                f.read(reinterpret_cast<char*>(&header.sampleRate), 4);
-                f.read(reinterpret_cast<char*>(&header.byteRate), 4);
-                f.read(reinterpret_cast<char*>(&header.blockAlign), 2);
-                f.read(reinterpret_cast<char*>(&header.bitsPerSample), 2);
-                if (sz > 16) f.seekg(sz - 16, std::ios::cur); // skip extras
-                header.subchunk1Size = sz;
-                if (header.audioFormat != 1) return false;
-                gotFmt = true;
-            }
-            else if (std::string(id, 4) == "data") {
-                header.subchunk2Size = sz;
-                samples.resize(sz);
-                if (!f.read(reinterpret_cast<char*>(samples.data()), sz)) return false;
-                gotData = true;
-            }
-            else
-                f.seekg(sz + (sz & 1u), std::ios::cur);
-        }
+        // reads up to max_samples interleaved samples into out, returns the samples read; fewer than asked only at the end or on an error
+        size_t read(int16_t* out, size_t max_samples);
+        bool rewind();
+        bool failed() const { return error; }
 
-        if ((!gotFmt || !gotData)  || samples.size() % 2) return false;
+    private:
+        WAVHeader header;
+        std::ifstream file;
+        SampleFormat format = SampleFormat::Unsupported;
+        bool dither = false;
+        bool error = false;
+        std::streamoff data_offset = 0;
+        size_t total_samples = 0;
+        size_t samples_read = 0;
+        std::vector<uint8_t> raw;
+    };
 
-        header.blockAlign = static_cast<uint16_t>((header.bitsPerSample / 8) * header.numChannels);
-        header.byteRate = header.sampleRate * header.blockAlign;
+    bool readWAV(const std::filesystem::path& filename, bool dither = false) {
+        Reader reader;
+        return reader.open(filename, dither) && load(reader);
+    }
 
-        return true;
+    // everything left in reader, header included
+    bool load(Reader& reader) {
+        header = reader.info();
+        const size_t count = reader.samples();
+        samples.resize(count * sizeof(int16_t));
+        return reader.read(reinterpret_cast<int16_t*>(samples.data()), count) == count;
     }
-    static bool writeWAV(const std::string& filename, std::vector<int16_t>& samples, uint32_t sampleRate, int nchannels = 1) {
+
+    static bool writeWAV(const std::string& filename, const std::vector<int16_t>& samples, uint32_t sampleRate, int nchannels = 1) {
         WAVHeader header;
         header.sampleRate = sampleRate;
         header.numChannels = nchannels;
@@ -99,4 +98,158 @@ struct WAV {
             return true;
         }
     }
+
+    // streams samples to disk and patches the chunk sizes once the length is known
+    class Writer {
+    public:
+        bool open(const std::string& filename, uint32_t sampleRate, int nchannels = 1) {
+            header = {};
+            header.sampleRate = sampleRate;
+            header.numChannels = nchannels;
+            header.bitsPerSample = 16;
+            header.blockAlign = (header.bitsPerSample * header.numChannels) / 8;
+            header.byteRate = header.sampleRate * header.blockAlign;
+            header.subchunk2Size = 0;
+            header.chunkSize = 36;
+
+            outFile.open(filename, std::ios::binary);
+            if (!outFile)
+                return false;
+            outFile.write(reinterpret_cast<const char*>(&header), sizeof(WAVHeader));
+            return outFile.good();
+        }
+
+        // everything written from here on is also fed to hash
+        void hash_into(ContentHash* hash) { content_hash = hash; }
+
+        void write(const int16_t* samples, size_t count) {
+            if (content_hash)
+                content_hash->update(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(samples), count * sizeof(int16_t)));
+            outFile.write(reinterpret_cast<const char*>(samples), count * sizeof(int16_t));
+            header.subchunk2Size += static_cast<uint32_t>(count * sizeof(int16_t));
+        }
+
+        bool close() {
+            header.chunkSize = 36 + header.subchunk2Size;
+            outFile.seekp(0, std::ios::beg);
+            outFile.write(reinterpret_cast<const char*>(&header), sizeof(WAVHeader));
+            outFile.close();
+            return !outFile.fail();
+        }
+
+    private:
+        WAVHeader header;
+        std::ofstream outFile;
+        ContentHash* content_hash = nullptr;
+    };
 };
+
+inline bool WAV::Reader::open(const std::filesystem::path& filename, bool dither)
+{
+    file.close();
+    file.clear();
+    file.open(filename, std::ios::binary);
+    if (!file.good()) return false;
+
+    this->dither = dither;
+    error = false;
+    format = SampleFormat::Unsupported;
+    total_samples = samples_read = 0;
+
+    char riff[4], wave[4];
+    uint32_t riffSize = 0;
+    if (!file.read(riff, 4) || !file.read(reinterpret_cast<char*>(&riffSize), 4) || !file.read(wave, 4))
+        return false;
+    if (std::string(riff, 4) != "RIFF" || std::string(wave, 4) != "WAVE")
+        return false;
+
+    // the data chunk is only noted here, it may even come before the fmt chunk
+    bool gotFmt = false, gotData = false;
+    uint32_t dataSize = 0;
+    while (file && !(gotFmt && gotData)) {
+        char id[4];
+        uint32_t sz = 0;
+        if (!file.read(id, 4) || !file.read(reinterpret_cast<char*>(&sz), 4)) break;
+
+        if (std::string(id, 4) == "fmt ") {
+            if (sz < 16) return false;
+            file.read(reinterpret_cast<char*>(&header.audioFormat), 2);
+            file.read(reinterpret_cast<char*>(&header.numChannels), 2);
+            file.read(reinterpret_cast<char*>(&header.sampleRate), 4);
+            file.read(reinterpret_cast<char*>(&header.byteRate), 4);
+            file.read(reinterpret_cast<char*>(&header.blockAlign), 2);
+            file.read(reinterpret_cast<char*>(&header.bitsPerSample), 2);
+            uint32_t extra = sz - 16;
+
+            // WAVE_FORMAT_EXTENSIBLE: cbSize, valid bits, channel mask, then the sub format GUID whose first two bytes are the real format
+            if (header.audioFormat == 0xFFFE && sz >= 40) {
+                uint8_t ext[24];
+                if (!file.read(reinterpret_cast<char*>(ext), sizeof ext)) return false;
+                header.audioFormat = uint16_t(ext[8] | (ext[9] << 8));
+                extra -= sizeof ext;
+            }
+            file.seekg(extra + (sz & 1u), std::ios::cur); // skip extras
+            format = GetSampleFormat(header.audioFormat, header.bitsPerSample);
+            if (format == SampleFormat::Unsupported || !file) return false;
+            gotFmt = true;
+        }
+        else if (std::string(id, 4) == "data") {
+            data_offset = file.tellg();
+            dataSize = sz;
+            gotData = true;
+            file.seekg(sz + (sz & 1u), std::ios::cur);
+        }
+        else
+            file.seekg(sz + (sz & 1u), std::ios::cur);
+    }
+    if (!gotFmt || !gotData) return false;
+
+    const int ch = channels();
+    total_samples = dataSize / SampleFormatBytes(format);
+
+    header.audioFormat = 1;
+    header.bitsPerSample = 16;
+    header.subchunk1Size = 16;
+    header.blockAlign = static_cast<uint16_t>(2 * ch);
+    header.byteRate = header.sampleRate * header.blockAlign;
+    header.subchunk2Size = static_cast<uint32_t>(total_samples * sizeof(int16_t));
+    header.chunkSize = 36 + header.subchunk2Size;
+    return rewind();
+}
+
+inline bool WAV::Reader::rewind()
+{
+    file.clear();
+    file.seekg(data_offset, std::ios::beg);
+    samples_read = 0;
+    error = !file.good();
+    return !error;
+}
+
+inline size_t WAV::Reader::read(int16_t* out, size_t max_samples)
+{
+    const size_t sample_bytes = SampleFormatBytes(format);
+    size_t done = 0;
+    max_samples = std::min(max_samples, total_samples - samples_read);
+
+    while (done < max_samples && !error) {
+        const size_t n = format == SampleFormat::Int16 ? max_samples - done : std::min(block_samples(), max_samples - done);
+        int16_t* dst = out + done;
+
+        // 16-bit goes straight to the caller, everything else through one block of scratch
+        uint8_t* src = reinterpret_cast<uint8_t*>(dst);
+        if (format != SampleFormat::Int16) {
+            raw.resize(block_samples() * sample_bytes);
+            src = raw.data();
+        }
+        if (!file.read(reinterpret_cast<char*>(src), std::streamsize(n * sample_bytes))) {
+            error = true;
+            break;
+        }
+        if (format != SampleFormat::Int16)
+            ConvertToInt16(src, format, n, dst, dither, samples_read + done);
+        done += n;
+    }
+    samples_read += done;
+    return done;
+}
@@ -9,76 +9,21 @@
 #include <algorithm>
 #include <bitset>
 #include <map>
+#include <span>
+#include <memory>
+#include <mutex>
 
+#include "mapped_file.h"
+#include "segment_writer.h"
 #include "wav.h"
 #include "adpcm1.h"
 #include "adpcm2.h"
+#include "resample.h"
 
-#include <unordered_map>
-
-// ------
-struct string_hash {
-    int hash;
-    string_hash(int h) : hash(h) {}
-    static constexpr inline std::uint32_t to_hash(const char* str) {
-        std::uint32_t res = 0;
-
-        for (int c = *str; c != '\0'; ++str, c = *str) {
-            int ch_lower = [](auto c) -> int {
-                if (isalpha(c))
-                    return tolower(c);
-                return c;
-                }(c);
-            res = ch_lower + 33 * res;
-        }
-
-        return res;
-    }
-};
+#include "string_hash_dictionary.h"
+#include "encode_cache.h"
 
-static inline void skip_newlines(std::string& s) {
-    while (!s.empty() && (s.back() == '\r' || s.back() == '\n')) s.pop_back();
-}
-
-static const std::unordered_map<uint32_t, std::string>& get_string_hash_dictionary() {
-    static std::unordered_map<uint32_t, std::string> dict;
-    static std::once_flag loaded_once;
-    std::call_once(loaded_once, [] {
-        std::ifstream in("string_hash_dictionary.txt");
-        if (!in) return;
-        std::string line;
-        std::getline(in, line); std::getline(in, line); std::getline(in, line); // skip first 3 lines
-        while (std::getline(in, line)) {
-            skip_newlines(line);
-            if (line.empty()) continue;
-
-            const auto tab_pos = line.find('\t');
-            if (tab_pos == std::string::npos) continue;
-
-            const std::string_view prefix(line.c_str(), tab_pos);
-            if (prefix.size() < 3 || prefix[0] != '0' || (prefix[1] != 'x' && prefix[1] != 'X')) continue;
-
-            uint32_t key = 0;
-            const char* first = line.c_str() + 2;
-            const char* last = line.c_str() + tab_pos; // up to tab
-            auto res = std::from_chars(first, last, key, 16);
-            if (res.ec != std::errc() || res.ptr != last) continue;
-
-            std::string value = line.substr(tab_pos + 1);
-            skip_newlines(value);
-            dict.emplace(key, std::move(value));
-        }
-        });
-    return dict;
-}
-
-std::string lookup_string_by_hash(uint32_t hash) {
-    const auto& dict = get_string_hash_dictionary();
-    if (auto it = dict.find(hash); it != dict.end())
-        return it->second;
-    return {};
-}
-// ------
+#include <unordered_map>
 
 class WBK {
 public:
@@ -153,20 +98,126 @@ public:
     static int GetDuration(const nslWave& wave);
     static double GetDurationMs(const nslWave& wave);
     static int GetBytesPerSample(Codec codec);
+    // bumped whenever an encoder's output changes, so cached payloads from older builds stop matching
+    static int GetEncoderVersion(Codec codec);
 
     std::vector<uint8_t> encode(const WAV& wav, Codec codec = Keep);
-
-    std::vector<int16_t> decode(std::vector<uint8_t> samples, const nslWave& entry);
+    // the same bytes, fed to the codec's incremental encoder a block at a time so the PCM is never held whole.
+    // with an encode cache the file is read twice, the first pass only hashing it for the lookup
+    std::vector<uint8_t> encode(WAV::Reader& source, Codec codec = Keep);
+    // bytes encode() produces for num_samples interleaved samples, 0 for codecs it doesn't encode
+    static size_t encoded_size(size_t num_samples, int num_channels, Codec codec);
+    // encodes into out, which needs encoded_size() bytes; returns the bytes written. bypasses the encode cache
+    size_t encode(std::span<const int16_t> pcm, int num_channels, Codec codec, std::span<uint8_t> out) const;
+    // encode() looks payloads up here first and stores what it had to encode, nullptr turns it off
+    void set_encode_cache(EncodeCache* cache) { encode_cache = cache; }
+    uint64_t encode_cache_key(const WAV& wav, Codec codec) const;
+    // samples is a ContentHash already fed the PCM
+    uint64_t encode_cache_key(ContentHash samples, int num_channels, uint32_t sample_rate, Codec codec) const;
+    // speed/quality trade-off of the ADPCM_1 encoder
+    void set_adpcm1_preset(Adpcm1Encoder::Preset preset) { adpcm1_preset = preset; }
+    // threads a single long ADPCM_1 track may be spread over
+    void set_encode_threads(unsigned num_threads) { encode_threads = num_threads ? num_threads : 1; }
+    // replacements are resampled to rate before encoding, 0 picks the replaced entry's own rate.
+    // negative (the default) keeps the WAV's rate
+    void set_resample_rate(int rate) { resample_rate = rate; }
+
+    // samples a payload decodes to, the size of the buffer decode() wants
+    static size_t decoded_size(std::span<const uint8_t> samples, const nslWave& entry);
+    // decodes into out, returns the samples written or 0 when out is too small
+    static size_t decode(std::span<const uint8_t> samples, const nslWave& entry, std::span<int16_t> out);
+    static std::vector<int16_t> decode(std::span<const uint8_t> samples, const nslWave& entry);
 
     int parse(std::istream& stream, const bool DecodeTracks = true);
+    int parse(std::span<const uint8_t> bank, const bool DecodeTracks = true);
     void read(const std::vector<uint8_t>& data, const bool DecodeTracks = true);
     int read(std::filesystem::path path, const bool DecodeTracks = true);
+    int map(std::filesystem::path path, const bool DecodeTracks = false);
     int write(std::filesystem::path path);
     int replace(int replacement_index, const WAV& wav, Codec codec = Keep);
     int replace(string_hash hash, const WAV& wav, Codec codec = Keep);
 
+    // collects replacements (encoded up front) and lays the bank out once on commit().
+    // replace() may be called from several threads at once
+    class Batch {
+    public:
+        explicit Batch(WBK& wbk) : wbk(wbk) {}
+
+        int replace(int replacement_index, const WAV& wav, Codec codec = Keep);
+        int replace(string_hash hash, const WAV& wav, Codec codec = Keep);
+        // encodes straight from the file, unless it has to be resampled or stored as PCM which loads it whole
+        int replace(int replacement_index, WAV::Reader& source, Codec codec = Keep);
+        // rebuilds the bank in memory
+        int commit();
+        // streams the rebuilt bank to path straight from the source ranges, then maps it
+        int commit(const std::filesystem::path& path);
+
+        // true when every new payload fits the space its entry already occupies
+        bool fits_in_place() const;
+        // overwrites just the payloads and their nslWave records in an on-disk copy of this bank, then maps it
+        int commit_in_place(const std::filesystem::path& path);
+
+        size_t size() const { return edits.size(); }
+
+    private:
+        struct Edit {
+            nslWave entry;
+            std::vector<uint8_t> encoded;
+        };
+
+        // every payload offset at or past sample_data_offs and the entry table, in order and inside the bank.
+        // layout() and the in-place writes take the space between two offsets as a payload, so nothing else is safe
+        bool layout_valid() const;
+        void layout(SegmentWriter& out) const;
+        // fills in the entry for an encoded replacement and stages it
+        int add(int replacement_index, Edit&& edit, Codec target_codec, int num_channels, uint32_t sample_rate, size_t num_samples);
+
+        WBK& wbk;
+        std::map<int, Edit> edits;
+        std::mutex edits_lock;
+    };
+
+    // views into the loaded bank (the mapping after map(), raw_data otherwise)
+    std::span<const uint8_t> bytes() const { return bank; }
+    const header_t& header_view() const { return *reinterpret_cast<const header_t*>(bank.data()); }
+    std::span<const nslWave> entry_table() const;
+    std::span<const metadata_t> metadata_table() const;
+    std::span<const uint8_t> payload(int index) const;
+    bool is_mapped() const { return mapping.is_open(); }
+
+    // entry position for a hash through an open-addressing index built by parse(), -1 if absent
+    int find(int hash) const;
+    // resolves a whole list at once, indices receives one position (or -1) per hash
+    void find(std::span<const int> hashes, std::span<int> indices) const;
+
+    // decodes one entry on demand, empty for an index out of range
+    std::vector<int16_t> track(int index) const;
+
+    // decodes one entry straight into a WAV file, chunk_bytes of the payload at a time.
+    // content_hash receives the ContentHash of the samples written, as WAV::samples would hold them on reading back
+    int extract(int index, const std::filesystem::path& output_path, size_t chunk_bytes = 64 * 1024, uint64_t* content_hash = nullptr) const;
+
 private:
+    std::vector<int16_t> decode_entry(nslWave entry) const;
+    void build_hash_index();
+
+    // slot -> entry index + 1, 0 marks an empty slot
+    std::vector<int32_t> hash_slots;
+    int hash_shift = 32;
+
+    size_t hash_slot(int hash) const { return size_t((uint32_t(hash) * 0x9E3779B9u) >> hash_shift); }
+
+    template <class Decoder>
+    bool stream_payload(std::span<const uint8_t> payload, Decoder& decoder, WAV::Writer& out, size_t chunk_bytes) const;
+
+    EncodeCache* encode_cache = nullptr;
+    Adpcm1Encoder::Preset adpcm1_preset = Adpcm1Encoder::Balanced;
+    unsigned encode_threads = 1;
+    int resample_rate = -1;
+
     std::vector<uint8_t> raw_data;
+    MappedFile mapping;
+    std::span<const uint8_t> bank;
 };
 
 
@@ -176,7 +227,11 @@ enum {
     WBK_FILE_TOO_LARGE,
     WBK_WRITE_ERROR,
     WBK_INVALID_REPLACE_INDEX,
-    WBK_HASH_NOT_FOUND
+    WBK_HASH_NOT_FOUND,
+    WBK_SLOT_TOO_SMALL,
+    WBK_READ_ERROR,
+    WBK_BAD_LAYOUT,
+    WBK_BAD_SAMPLE_RATE
 };
 
 
@@ -192,50 +247,13 @@ inline int WBK::GetNumChannels(const nslWave& wave) {
     return num_channels;
 }
 
-class membuf : public std::streambuf {
-public:
-    membuf(const char* base, size_t size) {
-        begin_ = const_cast<char*>(base);
-        end_ = begin_ + size;
-        setg(begin_, begin_, end_);
-    }
-protected:
-    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
-        std::ios_base::openmode which) override {
-        if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
-        char* newpos = nullptr;
-        switch (dir) {
-            case std::ios_base::beg: newpos = begin_ + off; break;
-            case std::ios_base::cur: newpos = gptr() + off; break;
-            case std::ios_base::end: newpos = end_ + off;   break;
-            default: return pos_type(off_type(-1));
-        }
-        if (newpos < begin_ || newpos > end_) return pos_type(off_type(-1));
-        setg(begin_, newpos, end_);
-        return pos_type(newpos - begin_);
-    }
-    pos_type seekpos(pos_type sp, std::ios_base::openmode which) override {
-        return seekoff(off_type(sp), std::ios_base::beg, which);
-    }
-private:
-    char* begin_{ nullptr };
-    char* end_{ nullptr };
-};
-
-
 void WBK::read(const std::vector<uint8_t>& data, const bool DecodeTracks)
 {
-    if (data.data() == raw_data.data() && !data.empty()) {
-        std::vector<uint8_t> tmp(data);
-        membuf sbuf(reinterpret_cast<const char*>(tmp.data()), tmp.size());
-        std::istream stream(&sbuf);
-        parse(stream, DecodeTracks);
-        return;
-    }
-
-    membuf sbuf(reinterpret_cast<const char*>(data.data()), data.size());
-    std::istream stream(&sbuf);
-    parse(stream, DecodeTracks);
+    // parsing never touches raw_data, so an aliasing buffer can be used as-is
+    if (data.data() != raw_data.data())
+        raw_data = data;
+    mapping.close();
+    parse(std::span<const uint8_t>(raw_data), DecodeTracks);
 }
 
 int WBK::read(std::filesystem::path path, const bool DecodeTracks)
@@ -244,6 +262,37 @@ int WBK::read(std::filesystem::path path, const bool DecodeTracks)
     if (!stream.good()) throw std::runtime_error("Failed to open file");
     return parse(stream, DecodeTracks);
 }
+
+int WBK::map(std::filesystem::path path, const bool DecodeTracks)
+{
+    MappedFile file;
+    if (!file.open(path)) throw std::runtime_error("Failed to map file");
+
+    mapping = std::move(file);
+    raw_data.clear();
+    raw_data.shrink_to_fit();
+    return parse(mapping.bytes(), DecodeTracks);
+}
+
+std::span<const WBK::nslWave> WBK::entry_table() const
+{
+    return { reinterpret_cast<const nslWave*>(bank.data() + sizeof header_t), entries.size() };
+}
+
+std::span<const WBK::metadata_t> WBK::metadata_table() const
+{
+    if (!header.metadata_offs || header.entry_desc_offs <= header.metadata_offs || size_t(header.entry_desc_offs) > bank.size())
+        return {};
+    const size_t count = size_t(header.entry_desc_offs - header.metadata_offs) / sizeof metadata_t;
+    return { reinterpret_cast<const metadata_t*>(bank.data() + header.metadata_offs), count };
+}
+
+std::span<const uint8_t> WBK::payload(int index) const
+{
+    const nslWave& entry = entries[index];
+    const size_t offs = std::min<size_t>(size_t(unsigned(entry.compressed_data_offs)), bank.size());
+    return bank.subspan(offs, std::min<size_t>(entry.num_bytes, bank.size() - offs));
+}
 inline void WBK::SetNumChannels(nslWave& wave, int num_channels) {
     unsigned char channel_mask = 0xFF, new_channel_bits = 0;
     for (int i = 0; i < num_channels; ++i)
@@ -331,152 +380,265 @@ void WBK::SetNumSamples(nslWave& wave, int num_samples)
 
 
 int WBK::parse(std::istream& stream, const bool DecodeTracks)
+{
+    if (!stream.good())
+        return WBK_PARSE_FAILED;
+
+    stream.seekg(0, std::ios::end);
+    size_t actual_file_size = stream.tellg();
+    stream.seekg(0, std::ios::beg);
+    raw_data.resize(actual_file_size);
+    stream.read((char*)raw_data.data(), actual_file_size);
+
+    mapping.close();
+    return parse(std::span<const uint8_t>(raw_data), DecodeTracks);
+}
+
+int WBK::parse(std::span<const uint8_t> data, const bool DecodeTracks)
 {
     // stay fresh
     entries.clear();
     tracks.clear();
     metadata.clear();
+    bank = {};
 
-    if (stream.good()) 
-    {
-        stream.seekg(0, std::ios::end);
-        size_t actual_file_size = stream.tellg();
-        stream.seekg(0, std::ios::beg);
-        raw_data.resize(actual_file_size);
-        stream.read((char*)raw_data.data(), actual_file_size);
-
-        stream.seekg(0, std::ios::beg);
-        stream.read(reinterpret_cast<char*>(&header), sizeof header_t);
-
-        if (header.total_bytes >= INT_MAX) {
-            printf("ERROR: Max file size, this WBK won't work in-game.\n");
-            return WBK_FILE_TOO_LARGE;
+    if (data.size() < sizeof header_t)
+        return WBK_PARSE_FAILED;
+
+    std::memcpy(&header, data.data(), sizeof header_t);
+
+    if (header.total_bytes >= INT_MAX) {
+        printf("ERROR: Max file size, this WBK won't work in-game.\n");
+        return WBK_FILE_TOO_LARGE;
+    }
+
+    const auto numEntries = header.num_entries;
+    if (numEntries < 0 || sizeof header_t + sizeof nslWave * size_t(numEntries) > data.size())
+        return WBK_PARSE_FAILED;
+
+    bank = data;
+    tracks.reserve(DecodeTracks ? numEntries : 0);
+    entries.reserve(numEntries);
+
+    // the bank group follows the metadata, or the entry table when there is none
+    size_t cursor = sizeof header_t;
+
+    // read all entries
+    for (int32_t index = 0; index < numEntries; ++index) {
+        nslWave entry;
+        std::memcpy(&entry, data.data() + sizeof header_t + (sizeof nslWave * index), sizeof nslWave);
+        cursor += sizeof nslWave;
+
+        // calc bits per sample & blockAlign
+        int bits_per_sample = 0;
+        int blockAlign = 0;
+        if (entry.codec == PCM || entry.codec == PCM2) {
+            bits_per_sample = 8 * (entry.codec != PCM) + 8;
+            blockAlign = (GetNumChannels(entry) * bits_per_sample) / 8;
+        }
+        else if (entry.codec == ADPCM_1) {
+            bits_per_sample = 16;
+            blockAlign = (bits_per_sample * GetNumChannels(entry)) / 8;
+        }
+        else if (entry.codec == ADPCM_2) {
+            bits_per_sample = 4;
+            blockAlign = 36 * GetNumChannels(entry);
+        }
+        else if (entry.codec == IMA_ADPCM) {
+            bits_per_sample = 16;
+            blockAlign = (bits_per_sample * GetNumChannels(entry)) / 8;
         }
 
-        const auto numEntries = header.num_entries;
-        tracks.reserve(numEntries);
-        entries.reserve(numEntries);
+        int num_channels = GetNumChannels(entry);
 
-        // read all entries
-        for (int32_t index = 0; index < numEntries; ++index) {
-            nslWave entry;
-            stream.seekg(sizeof header_t + (sizeof nslWave * index), std::ios::beg);
-            stream.read(reinterpret_cast<char*>(&entry), sizeof nslWave);
-
-            // calc bits per sample & blockAlign
-            int bits_per_sample = 0;
-            int size = 0;
-            int blockAlign = 0;
-            if (entry.codec == PCM || entry.codec == PCM2) {
-                bits_per_sample = 8 * (entry.codec != PCM) + 8;
-                blockAlign = (GetNumChannels(entry) * bits_per_sample) / 8;
-            }
-            else if (entry.codec == ADPCM_1) {
-                bits_per_sample = 16;
-                blockAlign = (bits_per_sample * GetNumChannels(entry)) / 8;
-            }
-            else if (entry.codec == ADPCM_2) {
-                bits_per_sample = 4;
-                blockAlign = 36 * GetNumChannels(entry);
-            }
-            else if (entry.codec == IMA_ADPCM) {
-                bits_per_sample = 16;
-                blockAlign = (bits_per_sample * GetNumChannels(entry)) / 8;
-            }
+#       if _DEBUG
+            printf("[%d] Hash: 0x%08X codec=%d num_samples=%d num_channels=%d rate=%dHz bps=%d length=%fs offs=0x%X\n", index,
+                entry.hash, entry.codec,
+                GetNumSamples(entry), num_channels,
+                entry.samples_per_second, bits_per_sample,
+                GetDurationMs(entry), entry.compressed_data_offs);
+#       endif
 
-            // calc size depending on format
-            int fmt_type = entry.codec - 4;
-            if (fmt_type) {
-                int tmp_type = fmt_type - 1;
-                if (!tmp_type)
-                    size = blockAlign * (entry.num_bytes >> 6);
-                else if (tmp_type != 2)
-                    size = entry.num_bytes;
-                else
-                    size = 4 * entry.num_samples;
-            }
-            else
-                size = 2 * entry.num_bytes;
-
-            int num_channels = GetNumChannels(entry);
-
-#           if _DEBUG
-                printf("[%d] Hash: 0x%08X codec=%d num_samples=%d num_channels=%d rate=%dHz bps=%d length=%fs offs=0x%X\n", index,
-                    entry.hash, entry.codec,
-                    GetNumSamples(entry), num_channels,
-                    entry.samples_per_second, bits_per_sample,
-                    GetDurationMs(entry), entry.compressed_data_offs);
-#           endif
-
-            entries.push_back(entry);
-
-            if (!DecodeTracks)
-                continue;
-
-            if (entry.codec == PCM || entry.codec == PCM2) {        // @todo: not seen these yet, but this won't work (seeks to 0x1000)
-                stream.seekg(0x1000, std::ios::beg);
-                std::vector<int16_t> tmp;
-                for (int i = 0; i < size / 4; ++i) {
-                    int16_t sample1, sample2;
-                    stream.read(reinterpret_cast<char*>(&sample1), 2);
-                    stream.read(reinterpret_cast<char*>(&sample2), 2);
-                    tmp.push_back(sample1);
-                    tmp.push_back(sample2);
+        entries.push_back(entry);
+
+        if (!DecodeTracks)
+            continue;
+
+        tracks.push_back(decode_entry(entry));
+    }
+
+    // read metadata
+    if (header.metadata_offs) {
+        size_t num_metadata = (header.entry_desc_offs - header.metadata_offs) / sizeof metadata_t;
+        if (num_metadata && header.metadata_offs + num_metadata * sizeof metadata_t <= data.size()) {
+            metadata.reserve(num_metadata);
+            cursor = header.metadata_offs;
+            for (int index = 0; index < num_metadata; ++index) {
+                metadata_t tmp_metadata;
+                std::memcpy(&tmp_metadata, data.data() + cursor, sizeof metadata_t);
+                cursor += sizeof metadata_t;
+                if (tmp_metadata.codec != 0) {
+                    metadata.push_back(tmp_metadata);
+#                   if _DEBUG
+                        printf("metadata #%d\tcodec = %d\t", index + 1, tmp_metadata.codec);
+                        for (int i = 0; i < 6; ++i)
+                            printf("%f%s", tmp_metadata.unk_fvals[i], i != 5 ? ", " : "\n");
+#                   endif
                 }
-                tracks.push_back(tmp);
-            }
-            // both IMA ADPCM and ADPCM (and other variants)
-            else if (entry.codec >= Reserved && entry.codec <= IMA_ADPCM) {
-                if (entry.codec == ADPCM_2)
-                    SetNumChannels(entry, 1);
-
-                std::vector<uint8_t> bdata;
-                stream.seekg(entry.compressed_data_offs, std::ios::beg);
-                auto samples_size = entry.num_bytes;
-                bdata.resize(samples_size);
-                stream.read((char*)bdata.data(), samples_size);
-                bdata.shrink_to_fit();
-
-                auto decoded_samples = decode(bdata, entry);
-                bdata.clear();
-                decoded_samples.shrink_to_fit();
-                tracks.push_back(decoded_samples);
             }
-            else
-                throw std::runtime_error((std::ostringstream{} << "Unsupported codec (" << entry.codec << ")").str());
-
         }
+    }
 
-        // read metadata
-        if (header.metadata_offs) {
-            size_t num_metadata = (header.entry_desc_offs - header.metadata_offs) / sizeof metadata_t;
-            if (num_metadata) {
-                metadata.reserve(num_metadata);
-                stream.seekg(header.metadata_offs, std::ios::beg);
-                for (int index = 0; index < num_metadata; ++index) {
-                    metadata_t tmp_metadata;
-                    stream.read(reinterpret_cast<char*>(&tmp_metadata), sizeof metadata_t);
-                    if (tmp_metadata.codec != 0) {
-                        metadata.push_back(tmp_metadata);
-#                       if _DEBUG
-                            printf("metadata #%d\tcodec = %d\t", index + 1, tmp_metadata.codec);
-                            for (int i = 0; i < 6; ++i)
-                                printf("%f%s", tmp_metadata.unk_fvals[i], i != 5 ? ", " : "\n");
-#                       endif
-                    }
-                }
+    entries.shrink_to_fit();
+    tracks.shrink_to_fit();
+    build_hash_index();
+
+    if (cursor + sizeof bank_group <= data.size())
+        std::memcpy(bank_group, data.data() + cursor, sizeof bank_group);
+    if (bank_group[0] != 0)
+        printf("Bank Type: %s\n", std::string(bank_group, strnlen(bank_group, sizeof bank_group)).c_str());
+    return WBK_OK;
+}
+
+void WBK::build_hash_index()
+{
+    // power of two, at most half full
+    size_t capacity = 2;
+    hash_shift = 31;
+    while (capacity < entries.size() * 2) {
+        capacity <<= 1;
+        --hash_shift;
+    }
+    hash_slots.assign(capacity, 0);
+
+    for (int index = 0; index < int(entries.size()); ++index) {
+        const int hash = entries[index].hash;
+        for (size_t slot = hash_slot(hash); ; slot = (slot + 1) & (capacity - 1)) {
+            if (!hash_slots[slot]) {
+                hash_slots[slot] = index + 1;
+                break;
             }
+            // duplicates keep pointing at the first entry, like a linear search would
+            if (entries[hash_slots[slot] - 1].hash == hash)
+                break;
         }
+    }
+}
 
-        entries.shrink_to_fit();
-        tracks.shrink_to_fit();
+int WBK::find(int hash) const
+{
+    if (hash_slots.empty())
+        return -1;
+    const size_t mask = hash_slots.size() - 1;
+    for (size_t slot = hash_slot(hash); hash_slots[slot]; slot = (slot + 1) & mask) {
+        if (entries[hash_slots[slot] - 1].hash == hash)
+            return hash_slots[slot] - 1;
+    }
+    return -1;
+}
 
-        stream.read(reinterpret_cast<char*>(&bank_group), 16);
-        if (bank_group[0] != 0)
-            printf("Bank Type: %s\n", std::string(bank_group).c_str());
-        return WBK_OK;
+void WBK::find(std::span<const int> hashes, std::span<int> indices) const
+{
+    const size_t count = std::min(hashes.size(), indices.size());
+    for (size_t i = 0; i < count; ++i)
+        indices[i] = find(hashes[i]);
+}
+
+std::vector<int16_t> WBK::decode_entry(nslWave entry) const
+{
+    if (entry.codec == PCM || entry.codec == PCM2) {        // @todo: not seen these yet, but this won't work (seeks to 0x1000)
+        const size_t avail = bank.size() > 0x1000 ? bank.size() - 0x1000 : 0;
+        const size_t pcm_bytes = std::min<size_t>(size_t(entry.num_bytes / 4) * 4, avail);
+        std::vector<int16_t> tmp(pcm_bytes / 2);
+        std::memcpy(tmp.data(), bank.data() + 0x1000, pcm_bytes);
+        return tmp;
+    }
+    // both IMA ADPCM and ADPCM (and other variants)
+    else if (entry.codec >= Reserved && entry.codec <= IMA_ADPCM) {
+        const size_t offs = std::min<size_t>(size_t(unsigned(entry.compressed_data_offs)), bank.size());
+        const size_t samples_size = std::min<size_t>(entry.num_bytes, bank.size() - offs);
+        return decode(bank.subspan(offs, samples_size), entry);
     }
-    return WBK_PARSE_FAILED;
+    else
+        throw std::runtime_error((std::ostringstream{} << "Unsupported codec (" << entry.codec << ")").str());
+}
+
+std::vector<int16_t> WBK::track(int index) const
+{
+    if (index < 0 || index >= int(entries.size()))
+        return {};
+    return decode_entry(entries[index]);
+}
+
+template <class Decoder>
+bool WBK::stream_payload(std::span<const uint8_t> payload, Decoder& decoder, WAV::Writer& out, size_t chunk_bytes) const
+{
+    chunk_bytes = std::max(chunk_bytes - chunk_bytes % decoder.frame_size, size_t(decoder.frame_size));
+    std::vector<int16_t> pcm(decoder.max_samples(chunk_bytes));
+
+    for (size_t pos = 0; pos < payload.size() && !decoder.done(); pos += chunk_bytes) {
+        const auto chunk = payload.subspan(pos, std::min(chunk_bytes, payload.size() - pos));
+        out.write(pcm.data(), decoder.decode(chunk.data(), chunk.size(), pcm.data()));
+        mapping.release(chunk);
+    }
+    return out.close();
+}
+
+int WBK::extract(int index, const std::filesystem::path& output_path, size_t chunk_bytes, uint64_t* content_hash) const
+{
+    if (index < 0 || index >= int(entries.size()))
+        return WBK_INVALID_REPLACE_INDEX;
+
+    const nslWave& entry = entries[index];
+    WAV::Writer out;
+    if (!out.open(output_path.string(), entry.samples_per_second, GetNumChannels(entry)))
+        return WBK_WRITE_ERROR;
+    ContentHash hash;
+    if (content_hash)
+        out.hash_into(&hash);
+
+    bool ok = false;
+    switch (entry.codec) {
+        case PCM:
+        case PCM2: {        // @todo: same as decode_entry(), PCM data is taken from 0x1000
+            const size_t avail = bank.size() > 0x1000 ? bank.size() - 0x1000 : 0;
+            const auto pcm = bank.subspan(0x1000, std::min<size_t>(size_t(entry.num_bytes / 4) * 4, avail));
+            out.write(reinterpret_cast<const int16_t*>(pcm.data()), pcm.size() / 2);
+            ok = out.close();
+            break;
+        }
+        case ADPCM_1: {
+            Adpcm1Decoder decoder(GetNumChannels(entry));
+            ok = stream_payload(payload(index), decoder, out, chunk_bytes);
+            break;
+        }
+        case ADPCM_2: {
+            Adpcm2Decoder decoder(GetNumChannels(entry));
+            ok = stream_payload(payload(index), decoder, out, chunk_bytes);
+            break;
+        }
+        case IMA_ADPCM: {
+            ImaAdpcmDecoder decoder(GetNumChannels(entry));
+            ok = stream_payload(payload(index), decoder, out, chunk_bytes);
+            break;
+        }
+        case Reserved:
+        case Reserved3: {   // no decoder, silence the size decode() would have produced
+            const std::vector<int16_t> silence(std::max<size_t>(chunk_bytes, 1), 0);
+            for (size_t left = 2 * size_t(payload(index).size()); left; ) {
+                const size_t n = std::min(left, silence.size());
+                out.write(silence.data(), n);
+                left -= n;
+            }
+            ok = out.close();
+            break;
+        }
+        default:
+            throw std::runtime_error((std::ostringstream{} << "Unsupported codec (" << entry.codec << ")").str());
+    }
+    if (content_hash)
+        *content_hash = hash.digest();
+    return ok ? WBK_OK : WBK_WRITE_ERROR;
 }
 
 int WBK::write(std::filesystem::path path) {
@@ -485,53 +647,151 @@ int WBK::write(std::filesystem::path path) {
 
     std::ofstream ofs(path, std::ios::binary);
     if (ofs.good()) {
-        ofs.write((char*)raw_data.data(), raw_data.size());
+        ofs.write((const char*)bank.data(), bank.size());
         ofs.close();
         return WBK_OK;
     }
     return WBK_WRITE_ERROR;
 }
 
+inline int WBK::GetEncoderVersion(Codec codec) {
+    switch (codec) {
+        case ADPCM_1: return 4;
+        case ADPCM_2: return 3;
+        case IMA_ADPCM: return 2;
+        default: return 0;
+    }
+}
+
+inline uint64_t WBK::encode_cache_key(const WAV& wav, Codec codec) const
+{
+    ContentHash h;
+    h.update(wav.samples);
+    return encode_cache_key(h, wav.header.numChannels, wav.header.sampleRate, codec);
+}
+
+inline uint64_t WBK::encode_cache_key(ContentHash h, int num_channels, uint32_t sample_rate, Codec codec) const
+{
+    h.update(uint64_t(num_channels));
+    h.update(uint64_t(sample_rate));
+    h.update(uint64_t(codec));
+    h.update(uint64_t(GetEncoderVersion(codec)));
+    if (codec == ADPCM_1)
+        h.update(uint64_t(adpcm1_preset));
+    return h.digest();
+}
+
+size_t WBK::encoded_size(size_t num_samples, int num_channels, Codec codec)
+{
+    switch (codec) {
+        case ADPCM_1: return Adpcm1EncodedSize(num_samples, num_channels);
+        case ADPCM_2: return Adpcm2EncodedSize(num_samples, num_channels);
+        case IMA_ADPCM: return ImaAdpcmEncodedSize(num_samples);
+        default: return 0;
+    }
+}
+
+size_t WBK::encode(std::span<const int16_t> pcm, int num_channels, Codec codec, std::span<uint8_t> out) const
+{
+    switch (codec) {
+        case ADPCM_1: return EncodeAdpcm1(pcm, num_channels, out, adpcm1_preset, encode_threads);
+        case ADPCM_2: return EncodeAdpcm2(pcm, num_channels, out, encode_threads);
+        case IMA_ADPCM: return EncodeImaAdpcm(pcm, num_channels, out);
+        default: return 0;
+    }
+}
+
 std::vector<uint8_t> WBK::encode(const WAV& wav, Codec codec)
 {
-    std::vector<uint8_t> res;
+    const bool cacheable = encode_cache && GetEncoderVersion(codec) != 0;
+    const uint64_t key = cacheable ? encode_cache_key(wav, codec) : 0;
+    if (cacheable) {
+        if (auto cached = encode_cache->load(key))
+            return std::move(*cached);
+    }
 
-    if (codec == IMA_ADPCM)
-        res = EncodeImaAdpcm(wav.samples, wav.header.numChannels);
-    else if (codec == ADPCM_1)
-    {
-        std::vector<int16_t> pcmSamples(wav.samples.size() / 2);
-        std::memcpy(pcmSamples.data(), wav.samples.data(), wav.samples.size());
+    // the WAV's bytes are read as samples where they lie
+    const std::span<const int16_t> pcm(reinterpret_cast<const int16_t*>(wav.samples.data()), wav.samples.size() / 2);
+    std::vector<uint8_t> res(encoded_size(pcm.size(), wav.header.numChannels, codec));
+    res.resize(encode(pcm, wav.header.numChannels, codec, res));
+
+    if (cacheable && !res.empty())
+        encode_cache->store(key, res);
+
+    return res;
+}
 
-        res = EncodeAdpcm1(pcmSamples, wav.header.numChannels);
+std::vector<uint8_t> WBK::encode(WAV::Reader& source, Codec codec)
+{
+    const int num_channels = source.channels();
+    std::vector<int16_t> block(source.block_samples());
+
+    const bool cacheable = encode_cache && GetEncoderVersion(codec) != 0;
+    uint64_t key = 0;
+    if (cacheable) {
+        ContentHash h;
+        while (size_t n = source.read(block.data(), block.size()))
+            h.update(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(block.data()), n * sizeof(int16_t)));
+        if (source.failed() || !source.rewind())
+            return {};
+        key = encode_cache_key(h, source.info().numChannels, source.info().sampleRate, codec);
+        if (auto cached = encode_cache->load(key))
+            return std::move(*cached);
     }
-    else if (codec == ADPCM_2)
-    {
-        std::vector<int16_t> pcmSamples(wav.samples.size() / 2);
-        std::memcpy(pcmSamples.data(), wav.samples.data(), wav.samples.size());
 
-        res = EncodeAdpcm2(pcmSamples, wav.header.numChannels);
+    // presized, so appending never reallocates
+    std::vector<uint8_t> res;
+    res.reserve(encoded_size(source.samples(), num_channels, codec));
+    auto stream = [&](auto&& encoder) {
+        while (size_t n = source.read(block.data(), block.size()))
+            encoder.encode(block.data(), n, res);
+        encoder.finish(res);
+    };
+    switch (codec) {
+        case ADPCM_1: stream(Adpcm1StreamEncoder(num_channels, adpcm1_preset)); break;
+        case ADPCM_2: stream(Adpcm2StreamEncoder(num_channels)); break;
+        case IMA_ADPCM: stream(ImaAdpcmStreamEncoder(num_channels)); break;
+        default: break;
     }
+    if (source.failed())
+        return {};
+
+    if (cacheable && !res.empty())
+        encode_cache->store(key, res);
 
     return res;
 }
-std::vector<int16_t> WBK::decode(std::vector<uint8_t> samples, const nslWave& entry)
+
+size_t WBK::decoded_size(std::span<const uint8_t> samples, const nslWave& entry)
 {
-    std::vector<int16_t> decoded_samples(2 * samples.size());
     switch (entry.codec) {
-        case ADPCM_1: {
-            decoded_samples = DecodeAdpcm1(samples);
-            break;
-        }
-        case ADPCM_2: {
-            decoded_samples = DecodeAdpcm2(samples, GetNumChannels(entry));
-            break;
-        }
-        case IMA_ADPCM: {
-            decoded_samples = DecodeImaAdpcm(samples, GetNumChannels(entry));
-            break;
-        }
+        case ADPCM_1: return Adpcm1DecodedSize(samples, GetNumChannels(entry));
+        case ADPCM_2: return Adpcm2DecodedSize(samples.size(), GetNumChannels(entry));
+        case IMA_ADPCM: return ImaAdpcmDecodedSize(samples.size());
+        default: return 2 * samples.size();
     }
+}
+
+size_t WBK::decode(std::span<const uint8_t> samples, const nslWave& entry, std::span<int16_t> out)
+{
+    const size_t count = decoded_size(samples, entry);
+    if (out.size() < count)
+        return 0;
+
+    switch (entry.codec) {
+        case ADPCM_1: return DecodeAdpcm1(samples, GetNumChannels(entry), out);
+        case ADPCM_2: return DecodeAdpcm2(samples, GetNumChannels(entry), out);
+        case IMA_ADPCM: return DecodeImaAdpcm(samples, GetNumChannels(entry), out);
+        default:        // no decoder, silence
+            std::fill_n(out.begin(), count, int16_t(0));
+            return count;
+    }
+}
+
+std::vector<int16_t> WBK::decode(std::span<const uint8_t> samples, const nslWave& entry)
+{
+    std::vector<int16_t> decoded_samples(decoded_size(samples, entry));
+    decode(samples, entry, decoded_samples);
     return decoded_samples;
 }
 
@@ -539,76 +799,279 @@ std::vector<int16_t> WBK::decode(std::vector<uint8_t> samples, const nslWave& en
 
 int WBK::replace(string_hash hash, const WAV& wav, Codec codec)
 {
-    auto it = std::find_if(entries.begin(), entries.end(), [hash](const nslWave& p) { return p.hash == hash.hash; });
-    if (it != entries.end())
-        return replace(int(std::distance(entries.begin(), it)), wav, codec);
-    return WBK_HASH_NOT_FOUND;
+    Batch batch(*this);
+    if (int res = batch.replace(hash, wav, codec); res != WBK_OK)
+        return res;
+    return batch.commit();
 }
 
 int WBK::replace(int replacement_index, const WAV& wav, Codec codec)
 {
-    if (replacement_index < 0 || replacement_index >= header.num_entries)
-        return WBK_INVALID_REPLACE_INDEX;
+    Batch batch(*this);
+    if (int res = batch.replace(replacement_index, wav, codec); res != WBK_OK)
+        return res;
+    return batch.commit();
+}
 
-    const nslWave orig = entries[replacement_index];
-    const Codec target_codec = (codec == Keep ? orig.codec : codec);
+int WBK::Batch::replace(string_hash hash, const WAV& wav, Codec codec)
+{
+    const int index = wbk.find(hash.hash);
+    if (index != -1)
+        return replace(index, wav, codec);
+    return WBK_HASH_NOT_FOUND;
+}
 
-    // copy everything from the original up until the track data we want to replace
-    std::vector<uint8_t> encoded_samples = encode(wav, target_codec);
-    std::vector<uint8_t> new_raw_data(raw_data.begin(), raw_data.begin() + orig.compressed_data_offs);
+int WBK::Batch::replace(int replacement_index, const WAV& source, Codec codec)
+{
+    if (replacement_index < 0 || replacement_index >= wbk.header.num_entries)
+        return WBK_INVALID_REPLACE_INDEX;
 
-    // insert the new track samples and calc the next available data offset
-    size_t next_data_offset = (orig.compressed_data_offs + encoded_samples.size() + 0x7FFF) & ~size_t(0x7FFF);
-    new_raw_data.insert(new_raw_data.end(), encoded_samples.begin(), encoded_samples.end());
-    new_raw_data.insert(new_raw_data.end(), next_data_offset - new_raw_data.size(), 0x00);
+    Edit edit{ wbk.entries[replacement_index], {} };
 
+    // optional resampling stage between reading the WAV and encoding it
+    const uint32_t rate = wbk.resample_rate > 0 ? uint32_t(wbk.resample_rate) : edit.entry.samples_per_second;
+    const bool resample = wbk.resample_rate >= 0 && rate != 0 && rate != source.header.sampleRate;
+    WAV resampled;
+    if (resample)
+        resampled = ResampleWav(source, rate, wbk.encode_threads);
+    const WAV& wav = resample ? resampled : source;
 
-    // for each entry after the replaced one, we insert it at the right location and modify its start offset.
-    for (int index = replacement_index + 1; index < header.num_entries; ++index) 
-    {
-        size_t data_start = entries[index].compressed_data_offs;
-        size_t data_end = (index + 1 != header.num_entries) ? 
-                            entries[index + 1].compressed_data_offs : raw_data.size();
-        size_t data_size = data_end - data_start;
+    // an entry stores its rate in 16 bits
+    if (wav.header.sampleRate > 0xFFFF)
+        return WBK_BAD_SAMPLE_RATE;
 
-        auto* new_entry = reinterpret_cast<nslWave*>(new_raw_data.data() + sizeof header_t + (sizeof nslWave * index));
-        new_entry->compressed_data_offs = static_cast<int>(next_data_offset);
+    const Codec target_codec = (codec == Keep ? edit.entry.codec : codec);
+    edit.encoded = wbk.encode(wav, target_codec);
+    return add(replacement_index, std::move(edit), target_codec, wav.header.numChannels, wav.header.sampleRate, wav.samples.size() / 2);
+}
 
-        new_raw_data.insert(new_raw_data.end(), raw_data.begin() + data_start, raw_data.begin() + data_end);
-        next_data_offset = (next_data_offset + data_size + 0x7FFF) & ~size_t(0x7FFF);
-        new_raw_data.insert(new_raw_data.end(), next_data_offset - new_raw_data.size(), 0x00);
+int WBK::Batch::replace(int replacement_index, WAV::Reader& source, Codec codec)
+{
+    if (replacement_index < 0 || replacement_index >= wbk.header.num_entries)
+        return WBK_INVALID_REPLACE_INDEX;
+
+    Edit edit{ wbk.entries[replacement_index], {} };
+    const Codec target_codec = (codec == Keep ? edit.entry.codec : codec);
+
+    // the resampler and the PCM codecs take the whole track
+    const uint32_t rate = wbk.resample_rate > 0 ? uint32_t(wbk.resample_rate) : edit.entry.samples_per_second;
+    const bool resample = wbk.resample_rate >= 0 && rate != 0 && rate != source.info().sampleRate;
+    if (resample || target_codec == PCM || target_codec == PCM2) {
+        WAV wav;
+        if (!wav.load(source))
+            return WBK_READ_ERROR;
+        return replace(replacement_index, wav, codec);
     }
+    if (source.info().sampleRate > 0xFFFF)
+        return WBK_BAD_SAMPLE_RATE;
 
+    edit.encoded = wbk.encode(source, target_codec);
+    if (source.failed())
+        return WBK_READ_ERROR;
+    return add(replacement_index, std::move(edit), target_codec, source.info().numChannels, source.info().sampleRate, source.samples());
+}
+
+int WBK::Batch::add(int replacement_index, Edit&& edit, Codec target_codec, int num_channels, uint32_t sample_rate, size_t num_samples)
+{
+    nslWave* replaced = &edit.entry;
 
     // update codec
-    auto* replaced = reinterpret_cast<nslWave*>(new_raw_data.data() + sizeof header_t + ( sizeof nslWave * replacement_index ));
     replaced->codec = target_codec;
 
     // update channels
-    if (GetNumChannels(*replaced) != wav.header.numChannels)
-        SetNumChannels(*replaced, wav.header.numChannels);
+    if (GetNumChannels(*replaced) != num_channels)
+        SetNumChannels(*replaced, num_channels);
 
     // update sample rate
-    replaced->samples_per_second = static_cast<unsigned short>(wav.header.sampleRate);
+    replaced->samples_per_second = static_cast<unsigned short>(sample_rate);
 
     if (target_codec == PCM || target_codec == PCM2) {
-        replaced->num_bytes = static_cast<unsigned>(wav.samples.size());
-        replaced->num_samples = GetNumSamples(*replaced);
+        replaced->num_bytes = static_cast<unsigned>(num_samples * sizeof(int16_t));
+        replaced->num_samples = wbk.GetNumSamples(*replaced);
     }
     else {
-        replaced->num_bytes = static_cast<unsigned>(encoded_samples.size());
-        const int ch = wav.header.numChannels ? wav.header.numChannels : 1;
-        const int frames = int(wav.samples.size() / (2 * ch));
-        replaced->num_samples = frames;
+        replaced->num_bytes = static_cast<unsigned>(edit.encoded.size());
+        const int ch = num_channels ? num_channels : 1;
+        replaced->num_samples = int(num_samples / ch);
     }
 
-    // update the total bytes and parse again
-    reinterpret_cast<header_t*>(new_raw_data.data())->total_bytes = static_cast<int>(new_raw_data.size());
-    raw_data.swap(new_raw_data);
-    std::vector<uint8_t> tmp = raw_data; // yes, a copy, but only during replace()
-    membuf sbuf(reinterpret_cast<const char*>(tmp.data()), tmp.size());
-    std::istream s(&sbuf);
-    parse(s, false);
-
+    std::lock_guard guard(edits_lock);
+    edits.insert_or_assign(replacement_index, std::move(edit));
     return WBK_OK;
-}
\ No newline at end of file
+}
+
+bool WBK::Batch::layout_valid() const
+{
+    const size_t table_size = sizeof header_t + sizeof nslWave * wbk.entries.size();
+    size_t prev = std::max(table_size, size_t(std::max(wbk.header.sample_data_offs, 0)));
+    for (const auto& entry : wbk.entries) {
+        if (entry.compressed_data_offs < 0 || size_t(entry.compressed_data_offs) < prev)
+            return false;
+        prev = size_t(entry.compressed_data_offs);
+    }
+    return prev <= wbk.bank.size();
+}
+
+void WBK::Batch::layout(SegmentWriter& out) const
+{
+    const std::span<const uint8_t> src = wbk.bank;
+    const auto& entries = wbk.entries;
+    const int num_entries = wbk.header.num_entries;
+    const int first_edit = edits.begin()->first;
+
+    // header and entry table get patched, so those are the only bytes copied
+    const size_t table_size = sizeof header_t + sizeof nslWave * size_t(num_entries);
+    const size_t kept_size = entries[first_edit].compressed_data_offs;
+    std::vector<uint8_t> table(src.begin(), src.begin() + std::min(table_size, kept_size));
+
+    std::vector<std::span<const uint8_t>> payloads;
+    payloads.reserve(num_entries - first_edit);
+
+    // lay out every payload from the first replaced one onwards, re-aligning each to 0x8000
+    size_t data_offset = kept_size;
+    for (int index = first_edit; index < num_entries; ++index)
+    {
+        auto it = edits.find(index);
+        auto* new_entry = reinterpret_cast<nslWave*>(table.data() + sizeof header_t + (sizeof nslWave * index));
+
+        if (it != edits.end()) {
+            payloads.push_back(it->second.encoded);
+            *new_entry = it->second.entry;
+        }
+        else {
+            size_t data_start = entries[index].compressed_data_offs;
+            size_t data_end = (index + 1 != num_entries) ?
+                                entries[index + 1].compressed_data_offs : src.size();
+            payloads.push_back(src.subspan(data_start, data_end - data_start));
+        }
+        new_entry->compressed_data_offs = static_cast<int>(data_offset);
+        data_offset = (data_offset + payloads.back().size() + 0x7FFF) & ~size_t(0x7FFF);
+    }
+
+    // update the total bytes
+    reinterpret_cast<header_t*>(table.data())->total_bytes = static_cast<int>(data_offset);
+
+    // everything up to the first replaced payload is kept as-is
+    const size_t table_end = table.size();
+    out.add(std::move(table));
+    out.add(src.subspan(table_end, kept_size - table_end));
+
+    size_t pos = kept_size;
+    for (const auto& payload : payloads) {
+        out.add(payload);
+        const size_t next = (pos + payload.size() + 0x7FFF) & ~size_t(0x7FFF);
+        out.add_zeros(next - pos - payload.size());
+        pos = next;
+    }
+}
+
+int WBK::Batch::commit()
+{
+    if (edits.empty())
+        return WBK_OK;
+    if (!layout_valid())
+        return WBK_BAD_LAYOUT;
+
+    SegmentWriter out;
+    layout(out);
+    std::vector<uint8_t> new_raw_data = out.gather();
+    edits.clear();
+
+    wbk.raw_data.swap(new_raw_data);
+    wbk.mapping.close();
+    return wbk.parse(std::span<const uint8_t>(wbk.raw_data), false);
+}
+
+int WBK::Batch::commit(const std::filesystem::path& path)
+{
+    if (edits.empty())
+        return WBK_OK;
+    if (!layout_valid())
+        return WBK_BAD_LAYOUT;
+
+    SegmentWriter out;
+    layout(out);
+
+    // path may well be the bank we're reading from, so write next to it and swap it in at the end
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+    std::error_code ec;
+    if (!out.write(tmp_path, [this](std::span<const uint8_t> written) { wbk.mapping.release(written); })) {
+        std::filesystem::remove(tmp_path, ec);
+        return WBK_WRITE_ERROR;
+    }
+
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec && wbk.mapping.is_open()) {
+        // windows won't replace a file that is still mapped, so let go of it and map it again if that wasn't it
+        const std::filesystem::path source = wbk.mapping.path();
+        wbk.mapping.close();
+        std::filesystem::rename(tmp_path, path, ec);
+        if (ec)
+            wbk.map(source);
+    }
+    if (ec) {
+        std::filesystem::remove(tmp_path, ec);
+        return WBK_WRITE_ERROR;
+    }
+
+    // the edits stay staged until the new bank is in place, so a failed commit can be retried
+    edits.clear();
+    return wbk.map(path);
+}
+
+bool WBK::Batch::fits_in_place() const
+{
+    if (!layout_valid())
+        return false;
+    const auto& entries = wbk.entries;
+    for (const auto& [index, edit] : edits) {
+        const size_t data_start = entries[index].compressed_data_offs;
+        const size_t data_end = (index + 1 != wbk.header.num_entries) ?
+                                entries[index + 1].compressed_data_offs : wbk.bank.size();
+        if (edit.encoded.size() > data_end - data_start)
+            return false;
+    }
+    return true;
+}
+
+int WBK::Batch::commit_in_place(const std::filesystem::path& path)
+{
+    if (edits.empty())
+        return WBK_OK;
+    if (!layout_valid())
+        return WBK_BAD_LAYOUT;
+    if (!fits_in_place())
+        return WBK_SLOT_TOO_SMALL;
+
+    std::fstream fs(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!fs.good())
+        return WBK_WRITE_ERROR;
+
+    static const char zeros[0x1000] = {};
+    for (const auto& [index, edit] : edits) {
+        const nslWave& orig = wbk.entries[index];
+        const size_t data_end = (index + 1 != wbk.header.num_entries) ?
+                                wbk.entries[index + 1].compressed_data_offs : wbk.bank.size();
+
+        // new payload over the old one, then zero the rest of the slot the same way a rebuild pads it
+        fs.seekp(orig.compressed_data_offs, std::ios::beg);
+        fs.write(reinterpret_cast<const char*>(edit.encoded.data()), edit.encoded.size());
+        for (size_t left = data_end - orig.compressed_data_offs - edit.encoded.size(); left; ) {
+            const size_t n = std::min(left, sizeof zeros);
+            fs.write(zeros, n);
+            left -= n;
+        }
+
+        nslWave entry = edit.entry;
+        entry.compressed_data_offs = orig.compressed_data_offs;
+        fs.seekp(sizeof header_t + (sizeof nslWave * index), std::ios::beg);
+        fs.write(reinterpret_cast<const char*>(&entry), sizeof nslWave);
+    }
+    fs.close();
+    if (fs.fail())
+        return WBK_WRITE_ERROR;
+
+    edits.clear();
+    return wbk.map(path);
+}
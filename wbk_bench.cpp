@@ -0,0 +1,247 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+
+#include "wbk.h"
+#include "synthetic_bank.h"
+
+// codec and bank benchmarks on synthetic input, results as JSON on stdout (or -o file), progress on stderr.
+// every input comes from a fixed seed, so two builds are measured on exactly the same bytes
+
+// every allocation in the process goes through these, so a benchmark can count its own
+static std::atomic<size_t> num_allocs{ 0 };
+static std::atomic<size_t> bytes_allocated{ 0 };
+
+void* operator new(size_t size)
+{
+    num_allocs.fetch_add(1, std::memory_order_relaxed);
+    bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+
+// every delete frees through here. out of line so GCC never inlines a free() where it can see the pointer came
+// from operator new, which -Wmismatched-new-delete takes for a mismatch
+#if defined(__GNUC__)
+__attribute__((noinline))
+#else
+__declspec(noinline)
+#endif
+static void release(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+
+struct Benchmark {
+    std::string name;
+    size_t samples = 0;         // PCM samples produced or consumed by one run, 0 where there are none
+    size_t bytes = 0;           // input bytes of one run
+    std::function<void()> prepare;      // untimed, before every run
+    std::function<void()> run;
+};
+
+struct Result {
+    size_t iterations = 0;
+    double seconds = 0;         // mean per run
+    double best_seconds = 0;
+    double allocs = 0;          // per run
+    double alloc_bytes = 0;
+};
+
+// keeps results alive so the optimizer can't drop the work
+static volatile size_t sink = 0;
+
+static constexpr uint64_t seed = 0x5EEDu;
+static constexpr size_t min_iterations = 3;
+
+static Result measure(const Benchmark& bench, double min_seconds)
+{
+    using clock = std::chrono::steady_clock;
+
+    // one run untimed, so first-touch page faults and lazily built tables don't count
+    if (bench.prepare)
+        bench.prepare();
+    bench.run();
+
+    Result res;
+    double total = 0;
+    size_t allocs = 0, alloc_bytes = 0;
+    while (res.iterations < min_iterations || total < min_seconds) {
+        if (bench.prepare)
+            bench.prepare();
+
+        const size_t allocs_before = num_allocs.load(), bytes_before = bytes_allocated.load();
+        const auto start = clock::now();
+        bench.run();
+        const double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        allocs += num_allocs.load() - allocs_before;
+        alloc_bytes += bytes_allocated.load() - bytes_before;
+
+        res.best_seconds = res.iterations ? std::min(res.best_seconds, elapsed) : elapsed;
+        total += elapsed;
+        ++res.iterations;
+    }
+    res.seconds = total / res.iterations;
+    res.allocs = double(allocs) / res.iterations;
+    res.alloc_bytes = double(alloc_bytes) / res.iterations;
+    return res;
+}
+
+static const char* codec_name(WBK::Codec codec)
+{
+    switch (codec) {
+        case WBK::ADPCM_1: return "adpcm1";
+        case WBK::ADPCM_2: return "adpcm2";
+        case WBK::IMA_ADPCM: return "ima_adpcm";
+        default: return "pcm";
+    }
+}
+
+// encode and decode of every codec, mono and stereo, a short effect and a long music track
+static void add_codec_benchmarks(std::vector<Benchmark>& benchmarks)
+{
+    struct Track { const char* name; size_t frames; };
+    static const Track lengths[] = { { "short", 8000 }, { "long", 32000 * 30 } };
+
+    for (WBK::Codec codec : { WBK::ADPCM_1, WBK::ADPCM_2, WBK::IMA_ADPCM }) {
+        for (int channels : { 1, 2 }) {
+            for (const Track& track : lengths) {
+                const std::string suffix = std::string(codec_name(codec)) + (channels == 1 ? "/mono/" : "/stereo/") + track.name;
+                auto pcm = std::make_shared<const std::vector<int16_t>>(SyntheticPcm(seed + track.frames + channels, track.frames, channels));
+                auto encoded = std::make_shared<std::vector<uint8_t>>();
+
+                Benchmark encode{ "encode/" + suffix, pcm->size(), pcm->size() * sizeof(int16_t), nullptr, nullptr };
+                switch (codec) {
+                    case WBK::ADPCM_1: encode.run = [=] { *encoded = EncodeAdpcm1(*pcm, channels); }; break;
+                    case WBK::ADPCM_2: encode.run = [=] { *encoded = EncodeAdpcm2(*pcm, channels); }; break;
+                    default: encode.run = [=] { *encoded = EncodeImaAdpcm(*pcm, channels); }; break;
+                }
+                // decoding reads what encoding wrote, so it is the same bytes in every run
+                encode.run();
+                benchmarks.push_back(encode);
+
+                Benchmark decode{ "decode/" + suffix, pcm->size(), encoded->size(), nullptr, nullptr };
+                switch (codec) {
+                    case WBK::ADPCM_1: decode.run = [=] { sink = sink + DecodeAdpcm1(*encoded, channels).size(); }; break;
+                    case WBK::ADPCM_2: decode.run = [=] { sink = sink + DecodeAdpcm2(*encoded, channels).size(); }; break;
+                    default: decode.run = [=] { sink = sink + DecodeImaAdpcm(*encoded, channels).size(); }; break;
+                }
+                benchmarks.push_back(decode);
+            }
+        }
+    }
+}
+
+// parse and replace on a bank the size of a level's and one far bigger than any shipped
+static void add_bank_benchmarks(std::vector<Benchmark>& benchmarks)
+{
+    struct Bank { const char* name; int num_entries; size_t min_frames, max_frames; };
+    static const Bank banks[] = { { "small", 16, 2000, 60000 }, { "huge", 4096, 500, 4000 } };
+
+    for (const Bank& bank : banks) {
+        SyntheticBankSpec spec;
+        spec.seed = seed + bank.num_entries;
+        spec.num_entries = bank.num_entries;
+        spec.min_frames = bank.min_frames;
+        spec.max_frames = bank.max_frames;
+        spec.group = "";        // parse() prints the group, which would end up in the JSON
+        auto bytes = std::make_shared<const std::vector<uint8_t>>(BuildSyntheticBank(spec));
+        auto wbk = std::make_shared<WBK>();
+
+        size_t total_samples = 0;
+        wbk->parse(*bytes, false);
+        for (const auto& entry : wbk->entries)
+            total_samples += WBK::decoded_size(wbk->bytes().subspan(entry.compressed_data_offs, entry.num_bytes), entry);
+
+        const std::string prefix = std::string("bank/") + bank.name;
+        benchmarks.push_back({ prefix + "/parse", 0, bytes->size(), nullptr, [=] { wbk->parse(*bytes, false); } });
+        benchmarks.push_back({ prefix + "/parse_decode", total_samples, bytes->size(), nullptr, [=] { wbk->parse(*bytes, true); } });
+
+        // one track in the middle of the bank replaced and the bank rebuilt in memory
+        const int index = bank.num_entries / 2;
+        const WBK::nslWave entry = wbk->entries[index];
+        auto wav = std::make_shared<const WAV>(SyntheticWav(seed + 1, bank.max_frames, WBK::GetNumChannels(entry), entry.samples_per_second));
+        benchmarks.push_back({ prefix + "/replace", wav->samples.size() / 2, bytes->size(),
+                               [=] { wbk->parse(*bytes, false); },
+                               [=] { wbk->replace(index, *wav); } });
+
+        if (bank.num_entries <= 16) {
+            // every track replaced in one batch
+            std::vector<WAV> wavs;
+            size_t samples = 0;
+            for (const auto& e : wbk->entries) {
+                wavs.push_back(SyntheticWav(seed + wavs.size(), size_t(e.num_samples), WBK::GetNumChannels(e), e.samples_per_second));
+                samples += wavs.back().samples.size() / 2;
+            }
+            auto all = std::make_shared<const std::vector<WAV>>(std::move(wavs));
+            benchmarks.push_back({ prefix + "/replace_all", samples, bytes->size(),
+                                   [=] { wbk->parse(*bytes, false); },
+                                   [=] {
+                                       WBK::Batch batch(*wbk);
+                                       for (int i = 0; i < int(all->size()); ++i)
+                                           batch.replace(i, (*all)[i]);
+                                       batch.commit();
+                                   } });
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    double min_seconds = 0.5;
+    std::string filter, output;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            min_seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            filter = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else {
+            printf("Usage:\n");
+            printf("  %s [-t seconds] [-f filter] [-o results.json]\n", argv[0]);
+            printf("  -t           Minimum time spent on each benchmark (default 0.5)\n");
+            printf("  -f           Only run benchmarks whose name contains filter, e.g. decode/ or bank/huge\n");
+            printf("  -o           Write the results to a file instead of stdout\n");
+            return -1;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+    add_codec_benchmarks(benchmarks);
+    add_bank_benchmarks(benchmarks);
+
+    FILE* out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (!out) {
+        printf("Failed to open %s!\n", output.c_str());
+        return -1;
+    }
+
+    fprintf(out, "{\n  \"seed\": %llu,\n  \"min_seconds\": %g,\n  \"benchmarks\": [", (unsigned long long)seed, min_seconds);
+    bool first = true;
+    for (const Benchmark& bench : benchmarks) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+            continue;
+
+        fprintf(stderr, "%s\n", bench.name.c_str());
+        const Result res = measure(bench, min_seconds);
+
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"iterations\": %zu, \"seconds_per_op\": %.9g, \"best_seconds\": %.9g, "
+                     "\"samples_per_s\": %.6g, \"mb_per_s\": %.6g, \"allocs_per_op\": %.6g, \"bytes_allocated_per_op\": %.6g }",
+                first ? "" : ",", bench.name.c_str(), res.iterations, res.seconds, res.best_seconds,
+                bench.samples / res.seconds, bench.bytes / res.seconds / 1e6, res.allocs, res.alloc_bytes);
+        first = false;
+    }
+    fprintf(out, "\n  ]\n}\n");
+
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,387 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include "wbk.h"
+#include "synthetic_bank.h"
+
+#ifdef _WIN32
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+// writes synthetic banks from a seed, or round trips ever bigger ones (extract, replace every track, extract
+// again and compare) and reports the time and memory each stage took as JSON
+
+// peak resident memory of the process so far
+static size_t peak_memory_bytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#   ifdef __APPLE__
+    return size_t(usage.ru_maxrss);
+#   else
+    return size_t(usage.ru_maxrss) * 1024;
+#   endif
+#endif
+}
+
+// "4:2,5,7" -> codecs 4, 5 and 7 weighted 2:1:1. all weights left out takes them in turn
+static bool parse_codecs(const char* arg, SyntheticBankSpec& spec)
+{
+    spec.codecs.clear();
+    spec.codec_weights.clear();
+    bool weighted = false;
+    for (const char* p = arg; *p; ) {
+        char* end = nullptr;
+        const long codec = strtol(p, &end, 10);
+        if (end == p || (codec != WBK::ADPCM_1 && codec != WBK::ADPCM_2 && codec != WBK::IMA_ADPCM))
+            return false;
+        unsigned weight = 1;
+        if (*end == ':') {
+            weight = unsigned(strtoul(end + 1, &end, 10));
+            weighted = true;
+        }
+        spec.codecs.push_back(WBK::Codec(codec));
+        spec.codec_weights.push_back(weight);
+        if (*end != ',' && *end != '\0')
+            return false;
+        p = *end ? end + 1 : end;
+    }
+    if (!weighted)
+        spec.codec_weights.clear();
+    return !spec.codecs.empty();
+}
+
+static bool write_bank(const SyntheticBankSpec& spec, const fs::path& path)
+{
+    SegmentWriter out;
+    if (!BuildSyntheticBank(spec, out)) {
+        printf("%d entries won't fit in a bank below 2GB!\n", spec.num_entries);
+        return false;
+    }
+    if (!out.write(path)) {
+        printf("Failed to write %s!\n", path.string().c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool extract_all(const fs::path& bank_path, const fs::path& folder)
+{
+    WBK wbk;
+    if (wbk.map(bank_path) != WBK_OK)
+        return false;
+    fs::create_directories(folder);
+    for (int index = 0; index < int(wbk.entries.size()); ++index) {
+        if (wbk.extract(index, folder / (std::to_string(index) + ".wav")) != WBK_OK)
+            return false;
+    }
+    return true;
+}
+
+// every track streamed back in from its WAV, the bank written out once
+static bool replace_all(const fs::path& bank_path, const fs::path& folder, const fs::path& output_path)
+{
+    WBK wbk;
+    if (wbk.map(bank_path) != WBK_OK)
+        return false;
+    WBK::Batch batch(wbk);
+    for (int index = 0; index < int(wbk.entries.size()); ++index) {
+        WAV::Reader reader;
+        if (!reader.open(folder / (std::to_string(index) + ".wav")) || batch.replace(index, reader) != WBK_OK)
+            return false;
+    }
+    return batch.size() == 0 || batch.commit(output_path) == WBK_OK;
+}
+
+static const char* codec_name(WBK::Codec codec)
+{
+    switch (codec) {
+        case WBK::ADPCM_1: return "adpcm1";
+        case WBK::ADPCM_2: return "adpcm2";
+        case WBK::IMA_ADPCM: return "ima_adpcm";
+        default: return "pcm";
+    }
+}
+
+// the lowest a second generation of each codec may come back at. ADPCM_1 and IMA ADPCM re-encode their own
+// output bit for bit, ADPCM_2 stays above 40 dB on synthetic material
+static double snr_floor_db(WBK::Codec codec)
+{
+    switch (codec) {
+        case WBK::ADPCM_1: return 40;
+        case WBK::ADPCM_2: return 30;
+        case WBK::IMA_ADPCM: return 40;
+        default: return 0;
+    }
+}
+
+// y against x, 200 when identical and NaN when x is silent
+static double snr_db(const int16_t* x, const int16_t* y, size_t count)
+{
+    double signal = 0, noise = 0;
+    for (size_t i = 0; i < count; ++i) {
+        signal += double(x[i]) * x[i];
+        noise += double(x[i] - y[i]) * (x[i] - y[i]);
+    }
+    if (signal == 0)
+        return NAN;
+    return noise == 0 ? 200.0 : 10 * std::log10(signal / noise);
+}
+
+// a first generation of every codec comes back above 23 dB even on IMA ADPCM's worst synthetic material; a
+// decoder reading another channel layout than the encoder wrote lands at 16 dB or below
+static constexpr double source_floor_db = 20;
+
+// every codec at 1-8 channels through the paths a bank really takes: Batch::replace() encodes, extract() and
+// track() decode. fails when the two disagree on the channel layout
+static int codec_check(const fs::path& work)
+{
+    SyntheticBankSpec spec;
+    spec.num_entries = 1;
+    spec.group = "";
+    const std::vector<uint8_t> bytes = BuildSyntheticBank(spec);
+    fs::create_directories(work);
+    const fs::path wav_path = work / "codec_check.wav";
+
+    int failures = 0;
+    bool first = true;
+    printf("  \"codec_check\": [");
+    for (WBK::Codec codec : { WBK::ADPCM_1, WBK::ADPCM_2, WBK::IMA_ADPCM }) {
+        for (int channels = 1; channels <= 8; ++channels) {
+            WBK wbk;
+            wbk.parse(bytes, false);
+            const WAV source = SyntheticWav(channels, 6000, channels, wbk.entries[0].samples_per_second);
+            const size_t count = source.samples.size() / 2;
+            const int16_t* x = reinterpret_cast<const int16_t*>(source.samples.data());
+
+            double extracted_db = -INFINITY, decoded_db = -INFINITY;
+            WAV extracted;
+            if (wbk.replace(0, source, codec) == WBK_OK && wbk.extract(0, wav_path) == WBK_OK && extracted.readWAV(wav_path) &&
+                extracted.header.numChannels == channels && extracted.samples.size() / 2 >= count)
+                extracted_db = snr_db(x, reinterpret_cast<const int16_t*>(extracted.samples.data()), count);
+            if (const std::vector<int16_t> track = wbk.track(0); track.size() >= count)
+                decoded_db = snr_db(x, track.data(), count);
+
+            const bool ok = extracted_db >= source_floor_db && decoded_db >= source_floor_db;
+            failures += !ok;
+            printf("%s\n    { \"codec\": \"%s\", \"channels\": %d, \"ok\": %s, \"extract_snr_db\": %.2f, \"decode_snr_db\": %.2f }",
+                   first ? "" : ",", codec_name(codec), channels, ok ? "true" : "false", extracted_db, decoded_db);
+            first = false;
+        }
+    }
+    printf("\n  ],\n");
+    std::error_code ec;
+    fs::remove(wav_path, ec);
+    return failures;
+}
+
+struct CodecSnr {
+    int measured = 0;
+    double min_snr_db = INFINITY;
+    double mean_snr_db = 0;
+    int worst = -1;             // the entry min_snr_db came from
+};
+
+struct Comparison {
+    int mismatches = 0;         // entries whose hash, codec, channels, rate or length changed
+    int below_floor = 0;        // entries under their codec's snr_floor_db()
+    CodecSnr codecs[8];         // by codec number
+
+    bool ok() const { return mismatches == 0 && below_floor == 0; }
+};
+
+// the re-encoded tracks against the ones first extracted. lengths must match exactly, the audio only as well as
+// a second generation of lossy encoding allows
+static Comparison compare(const fs::path& bank_path, const fs::path& new_bank_path, const fs::path& before, const fs::path& after)
+{
+    Comparison res;
+    WBK original, rebuilt;
+    if (original.map(bank_path) != WBK_OK || rebuilt.map(new_bank_path) != WBK_OK || original.entries.size() != rebuilt.entries.size()) {
+        res.mismatches = -1;
+        return res;
+    }
+
+    for (int index = 0; index < int(original.entries.size()); ++index) {
+        const WBK::nslWave& a = original.entries[index];
+        const WBK::nslWave& b = rebuilt.entries[index];
+        WAV first, second;
+        const std::string name = std::to_string(index) + ".wav";
+        if (a.hash != b.hash || a.codec != b.codec || WBK::GetNumChannels(a) != WBK::GetNumChannels(b) ||
+            a.samples_per_second != b.samples_per_second || !first.readWAV(before / name) || !second.readWAV(after / name) ||
+            first.samples.size() != second.samples.size()) {
+            ++res.mismatches;
+            continue;
+        }
+
+        const double snr = snr_db(reinterpret_cast<const int16_t*>(first.samples.data()),
+                                  reinterpret_cast<const int16_t*>(second.samples.data()), first.samples.size() / 2);
+        if (std::isnan(snr))
+            continue;
+        if (snr < snr_floor_db(a.codec))
+            ++res.below_floor;
+
+        CodecSnr& stats = res.codecs[a.codec % 8];
+        if (snr < stats.min_snr_db) {
+            stats.min_snr_db = snr;
+            stats.worst = index;
+        }
+        stats.mean_snr_db += snr;
+        ++stats.measured;
+    }
+    for (CodecSnr& stats : res.codecs)
+        stats.mean_snr_db = stats.measured ? stats.mean_snr_db / stats.measured : 0;
+    return res;
+}
+
+// num_entries, then twice as many, steps times. peak memory only ever grows, so the smallest bank goes first
+static int round_trip(SyntheticBankSpec spec, const fs::path& work, int steps, bool keep)
+{
+    using clock = std::chrono::steady_clock;
+    auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+    spec.group = "";            // parse() prints the group, which would end up in the JSON
+    printf("{\n  \"seed\": %llu,\n", (unsigned long long)spec.seed);
+    int failures = codec_check(work);
+    printf("  \"steps\": [");
+    for (int step = 0; step < steps; ++step, spec.num_entries *= 2) {
+        const fs::path folder = work / std::to_string(spec.num_entries);
+        const fs::path bank_path = folder / "bank.wbk";
+        const fs::path new_bank_path = folder / "bank.new.wbk";
+        fs::create_directories(folder);
+
+        auto start = clock::now();
+        if (!write_bank(spec, bank_path))
+            break;
+        const double generate_s = seconds_since(start);
+        const size_t generate_peak = peak_memory_bytes();
+
+        start = clock::now();
+        const bool extracted = extract_all(bank_path, folder / "before");
+        const double extract_s = seconds_since(start);
+        const size_t extract_peak = peak_memory_bytes();
+
+        start = clock::now();
+        const bool replaced = extracted && replace_all(bank_path, folder / "before", new_bank_path);
+        const double replace_s = seconds_since(start);
+        const size_t replace_peak = peak_memory_bytes();
+
+        start = clock::now();
+        Comparison cmp;
+        cmp.mismatches = -1;
+        if (replaced && extract_all(new_bank_path, folder / "after"))
+            cmp = compare(bank_path, new_bank_path, folder / "before", folder / "after");
+        const double compare_s = seconds_since(start);
+
+        std::error_code ec;
+        const uintmax_t bank_bytes = fs::file_size(bank_path, ec);
+        printf("%s\n    { \"entries\": %d, \"bank_bytes\": %llu, \"ok\": %s, \"mismatches\": %d, \"below_floor\": %d, "
+               "\"generate_s\": %.3f, \"extract_s\": %.3f, \"replace_s\": %.3f, \"compare_s\": %.3f, "
+               "\"generate_peak_mb\": %.1f, \"extract_peak_mb\": %.1f, \"replace_peak_mb\": %.1f, \"codecs\": {",
+               step ? "," : "", spec.num_entries, (unsigned long long)bank_bytes, cmp.ok() ? "true" : "false",
+               cmp.mismatches, cmp.below_floor, generate_s, extract_s, replace_s, compare_s,
+               generate_peak / 1048576.0, extract_peak / 1048576.0, replace_peak / 1048576.0);
+        bool first = true;
+        for (int codec = 0; codec < 8; ++codec) {
+            const CodecSnr& stats = cmp.codecs[codec];
+            if (!stats.measured)
+                continue;
+            printf("%s \"%s\": { \"entries\": %d, \"floor_db\": %.0f, \"min_snr_db\": %.2f, \"worst_entry\": %d, \"mean_snr_db\": %.2f }",
+                   first ? "" : ",", codec_name(WBK::Codec(codec)), stats.measured, snr_floor_db(WBK::Codec(codec)),
+                   stats.min_snr_db, stats.worst, stats.mean_snr_db);
+            first = false;
+        }
+        printf(" } }");
+        fflush(stdout);
+        failures += !cmp.ok();
+
+        if (!keep)
+            fs::remove_all(folder, ec);
+    }
+    printf("\n  ]\n}\n");
+    return failures ? -1 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("Usage:\n");
+        printf("  %s <output.wbk> [options]              Write a synthetic bank\n", argv[0]);
+        printf("  %s -t <work_folder> [options]          Round trip banks of -n, 2n, 4n... entries, results as JSON\n", argv[0]);
+        printf("  -s <seed>          Seed, the same seed and options give the same bank (default 1)\n");
+        printf("  -n <entries>       Number of tracks (default 16)\n");
+        printf("  -c <codecs>        Codec numbers, each with an optional weight, e.g. 4:2,5,7 (default 4,5,7 in turn)\n");
+        printf("  -l <min>-<max>     Track length in frames (default 1000-50000)\n");
+        printf("  -g                 Spread lengths evenly per octave, mostly short tracks\n");
+        printf("  -m <channels>      Most channels a track may have, 1-8 (default 2)\n");
+        printf("  -b <bytes>         Pad the payload slots until the bank is this big, at most 2147450880\n");
+        printf("  -x <steps>         Round trip steps (default 4)\n");
+        printf("  -k                 Keep each step's banks and WAVs\n");
+        return -1;
+    }
+
+    SyntheticBankSpec spec;
+    int steps = 4;
+    bool keep = false;
+    const bool harness = strcmp(argv[1], "-t") == 0;
+    if (harness && argc < 3) {
+        printf("Missing work folder!\n");
+        return -1;
+    }
+    const fs::path target = harness ? argv[2] : argv[1];
+
+    for (int i = harness ? 3 : 2; i < argc; ++i) {
+        const bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-s") == 0 && has_value)
+            spec.seed = strtoull(argv[++i], nullptr, 0);
+        else if (strcmp(argv[i], "-n") == 0 && has_value)
+            spec.num_entries = std::max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-c") == 0 && has_value) {
+            if (!parse_codecs(argv[++i], spec)) {
+                printf("Invalid codec list %s, codecs are 4 (ADPCM_1), 5 (ADPCM_2) and 7 (IMA ADPCM)\n", argv[i]);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "-l") == 0 && has_value) {
+            unsigned long long lo = 0, hi = 0;
+            if (sscanf(argv[++i], "%llu-%llu", &lo, &hi) != 2 || lo > hi) {
+                printf("Invalid length range %s\n", argv[i]);
+                return -1;
+            }
+            spec.min_frames = size_t(lo);
+            spec.max_frames = size_t(hi);
+        }
+        else if (strcmp(argv[i], "-g") == 0)
+            spec.log_lengths = true;
+        else if (strcmp(argv[i], "-m") == 0 && has_value)
+            spec.max_channels = std::clamp(atoi(argv[++i]), 1, 8);
+        else if (strcmp(argv[i], "-b") == 0 && has_value)
+            spec.target_bytes = size_t(strtoull(argv[++i], nullptr, 0));
+        else if (strcmp(argv[i], "-x") == 0 && has_value)
+            steps = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "-k") == 0)
+            keep = true;
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if (harness)
+        return round_trip(spec, target, steps, keep);
+
+    if (!write_bank(spec, target))
+        return -1;
+    printf("Written to %s\n", target.string().c_str());
+    return 1;
+}
@@ -1,16 +1,472 @@
 #include "wbk.h"
+#include "thread_pool.h"
+#include "hash_crack.h"
+#include "manifest.h"
 
 namespace fs = std::filesystem;
 
+// .wbk in any case, banks copied off a disc often come as .WBK
+static bool is_wbk_path(const fs::path& path)
+{
+    const std::string ext = path.extension().string();
+    return ext.size() == 4 && std::equal(ext.begin(), ext.end(), ".wbk", [](char a, char b) { return tolower(a) == b; });
+}
+
+// hashes of the given banks (or a text file of hex hashes) that the dictionary can't name yet
+static std::vector<uint32_t> collect_unresolved_hashes(const fs::path& source)
+{
+    std::vector<uint32_t> hashes;
+    auto add_bank = [&hashes](const fs::path& path) {
+        WBK wbk;
+        if (wbk.map(path) != WBK_OK)
+            return;
+        for (const auto& entry : wbk.entries)
+            if (get_string_hash_dictionary().find(uint32_t(entry.hash)).empty())
+                hashes.push_back(uint32_t(entry.hash));
+    };
+
+    if (fs::is_directory(source)) {
+        for (const auto& file : fs::recursive_directory_iterator(source))
+            if (file.is_regular_file() && is_wbk_path(file.path()))
+                add_bank(file.path());
+    }
+    else if (is_wbk_path(source))
+        add_bank(source);
+    else {
+        std::ifstream in(source);
+        std::string line;
+        while (std::getline(in, line)) {
+            skip_newlines(line);
+            const bool hex = line.size() > 2 && line[0] == '0' && (line[1] == 'x' || line[1] == 'X');
+            uint32_t hash = 0;
+            const char* first = line.c_str() + (hex ? 2 : 0);
+            if (std::from_chars(first, line.c_str() + line.size(), hash, hex ? 16 : 10).ec == std::errc()
+                && get_string_hash_dictionary().find(hash).empty())
+                hashes.push_back(hash);
+        }
+    }
+    return hashes;
+}
+
+static int crack_hashes(int argc, char** argv)
+{
+    unsigned num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> patterns;
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            num_threads = unsigned(std::max(1, atoi(argv[++i])));
+        else
+            patterns.push_back(argv[i]);
+    }
+
+    std::vector<std::string> words;
+    {
+        std::ifstream in(argv[3]);
+        if (!in) {
+            printf("Failed to open word list %s!\n", argv[3]);
+            return -1;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            skip_newlines(line);
+            if (!line.empty())
+                words.push_back(std::move(line));
+        }
+    }
+
+    HashCracker cracker(collect_unresolved_hashes(argv[2]));
+    for (const auto& pattern : patterns) {
+        std::string error;
+        if (!cracker.add_pattern(pattern, words, error)) {
+            printf("Invalid pattern \"%s\": %s\n", pattern.c_str(), error.c_str());
+            return -1;
+        }
+    }
+
+    printf("Trying %llu candidates on %u threads\n", (unsigned long long)cracker.candidates(), num_threads);
+    ThreadPool pool(num_threads);
+    auto found = cracker.run(pool);
+
+    // one name per hash, the first in sort order, the rest are reported as collisions
+    std::vector<std::pair<uint32_t, std::string>> names;
+    for (const auto& [hash, name] : found) {
+        if (!names.empty() && names.back().first == hash) {
+            printf("  0x%08x\t%s (collision, not added)\n", hash, name.c_str());
+            continue;
+        }
+        printf("  0x%08x\t%s\n", hash, name.c_str());
+        names.emplace_back(hash, name);
+    }
+
+    if (!names.empty() && !append_to_string_hash_dictionary("string_hash_dictionary.txt", names)) {
+        printf("Failed to update string_hash_dictionary.txt!\n");
+        return -1;
+    }
+    printf("Recovered %zu names\n", names.size());
+    return 1;
+}
+
+struct ToolOptions {
+    bool hashSearch = false;
+    bool resolveHashes = false;
+    bool in_place = false;
+    WBK::Codec codec = WBK::Keep;
+    EncodeCache* cache = nullptr;
+    Adpcm1Encoder::Preset preset = Adpcm1Encoder::Balanced;
+    unsigned num_threads = 1;
+    int resample_rate = -1;     // -1 keeps the WAV's rate, 0 converts to the entry's
+    bool dither = false;        // when converting WAVs deeper than 16 bits
+};
+
+static std::string make_filename(const WBK& wbk, const ToolOptions& opts, int i)
+{
+    const bool hash = opts.hashSearch;
+    auto h = hash && opts.resolveHashes ? lookup_string_by_hash(wbk.entries[i].hash) : std::string_view();
+    return hash ? opts.resolveHashes && !h.empty() ?
+                    std::format("{}.wav", h)
+                    : std::format("0x{:08x}.wav", wbk.entries[i].hash)
+                : std::format("{}.wav", i);
+}
+
+// a folder is searched for .wbk files, anything else is read as a list with one bank per line.
+// each bank comes with the sub folder its tracks go to, relative to the output/replacement folder
+static std::vector<std::pair<fs::path, fs::path>> collect_banks(const fs::path& source)
+{
+    std::vector<std::pair<fs::path, fs::path>> banks;
+    if (fs::is_directory(source)) {
+        for (const auto& file : fs::recursive_directory_iterator(source)) {
+            const auto& path = file.path();
+            if (file.is_regular_file() && is_wbk_path(path) && path.stem().extension() != ".new")
+                banks.emplace_back(path, fs::relative(path, source).replace_extension());
+        }
+        std::sort(banks.begin(), banks.end());
+    }
+    else {
+        std::ifstream in(source);
+        std::string line;
+        while (std::getline(in, line)) {
+            skip_newlines(line);
+            if (!line.empty())
+                banks.emplace_back(line, fs::path(line).stem());
+        }
+    }
+    return banks;
+}
+
+// writes the staged replacements next to the bank (or over it with -i), returns a WBK_ code
+static int write_batch(WBK::Batch& batch, const fs::path& bank_path, bool in_place)
+{
+    fs::path path = in_place ? bank_path : fs::path(bank_path).replace_extension(".new.wbk");
+
+    // when every new payload fits its old slot only those bytes and records need writing
+    int res = WBK_OK;
+    if (batch.fits_in_place()) {
+        std::error_code ec;
+        if (!in_place && !fs::copy_file(bank_path, path, fs::copy_options::overwrite_existing, ec))
+            res = WBK_WRITE_ERROR;
+        else
+            res = batch.commit_in_place(path);
+    }
+    else
+        res = batch.commit(path);
+
+    if (res == WBK_BAD_LAYOUT)
+        printf("%s has overlapping or out of range payloads, it can't be rebuilt!\n", bank_path.string().c_str());
+    else if (res != WBK_OK)
+        printf("Failed to write %s!\n", path.string().c_str());
+    else
+        printf("Written to %s\n", path.string().c_str());
+    return res;
+}
+
+// true when the manifest line still describes this entry and the codec it would be encoded to
+static bool manifest_matches(const Manifest::Track* track, const WBK::nslWave& entry, WBK::Codec codec)
+{
+    return track && track->hash == uint32_t(entry.hash) && track->codec == entry.codec && (codec == WBK::Keep || codec == entry.codec);
+}
+
+// one bank being extracted, whichever track task finishes last writes the manifest
+struct ExtractJob {
+    WBK wbk;
+    Manifest manifest;
+    fs::path manifest_path;
+    std::atomic<int> remaining{ 0 };
+
+    void finish() {
+        try {
+            if (!manifest.save(manifest_path))
+                printf("Failed to write %s!\n", manifest_path.string().c_str());
+        }
+        catch (const std::exception& e) {
+            printf("Failed to write %s: %s\n", manifest_path.string().c_str(), e.what());
+        }
+    }
+};
+
+// maps the bank and queues one task per track on the shared pool, the tasks keep the bank alive
+static void extract_bank(ThreadPool& pool, const fs::path& bank_path, const fs::path& base_path, const ToolOptions& opts)
+{
+    auto job = std::make_shared<ExtractJob>();
+    try {
+        if (job->wbk.map(bank_path) != WBK_OK) {
+            printf("Failed to parse %s!\n", bank_path.string().c_str());
+            return;
+        }
+    }
+    catch (const std::exception& e) {
+        printf("%s: %s\n", bank_path.string().c_str(), e.what());
+        return;
+    }
+
+    if (!fs::exists(base_path))
+        fs::create_directories(base_path);
+
+    const auto& entries = job->wbk.entries;
+    job->manifest_path = base_path / Manifest::file_name;
+    job->manifest.tracks.resize(entries.size());
+    job->remaining = int(entries.size());
+    if (entries.empty()) {
+        job->finish();
+        return;
+    }
+
+    // biggest tracks first, the pool starts tasks in submission order so the long ones don't end up last
+    std::vector<int> order(entries.size());
+    for (int index = 0; index < int(order.size()); ++index)
+        order[index] = index;
+    std::stable_sort(order.begin(), order.end(), [&entries](int a, int b) { return entries[a].num_bytes > entries[b].num_bytes; });
+
+    for (int index : order) {
+        std::string file_name = make_filename(job->wbk, opts, index);
+        fs::path output_path = base_path / file_name;
+        pool.submit([job, index, file_name = std::move(file_name), output_path = std::move(output_path)] {
+            const WBK::nslWave& entry = job->wbk.entries[index];
+            Manifest::Track track;
+            try {
+                if (job->wbk.extract(index, output_path, 64 * 1024, &track.content_hash) != WBK_OK)
+                    printf("Failed to extract %s!\n", output_path.string().c_str());
+                else if (Manifest::stat(output_path, track.size, track.mtime)) {
+                    track.index = index;
+                    track.hash = uint32_t(entry.hash);
+                    track.file = file_name;
+                    track.codec = entry.codec;
+                    track.channels = WBK::GetNumChannels(entry);
+                    track.rate = entry.samples_per_second;
+                    job->manifest.tracks[index] = std::move(track);
+                }
+            }
+            catch (const std::exception& e) {
+                printf("Failed to extract %s: %s\n", output_path.string().c_str(), e.what());
+            }
+
+            if (--job->remaining == 0)
+                job->finish();
+        });
+    }
+}
+
+// folder replacement for one bank: every matching WAV is read and encoded as its own task,
+// whichever finishes last reports in index order and writes the bank.
+// with a manifest from -e in the folder, WAVs that haven't changed since are left alone
+// ContentHash of the samples, as ContentHash::of(wav.samples) would give for the loaded file; leaves reader at the start
+static uint64_t hash_samples(WAV::Reader& reader)
+{
+    ContentHash h;
+    std::vector<int16_t> block(reader.block_samples());
+    while (size_t n = reader.read(block.data(), block.size()))
+        h.update(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(block.data()), n * sizeof(int16_t)));
+    reader.rewind();
+    return h.digest();
+}
+
+struct ReplaceJob {
+    enum { Missing = -1, BadWav = -2, Unchanged = -3, Failed = -4 };
+
+    fs::path bank_path;
+    ToolOptions opts;
+    WBK wbk;
+    std::unique_ptr<WBK::Batch> batch;
+    std::vector<int> results;
+    std::atomic<int> remaining{ 0 };
+    std::atomic<int>* written = nullptr;
+
+    bool has_manifest = false;
+    fs::path manifest_path;
+    Manifest manifest;
+    std::vector<Manifest::Track> replaced;  // what the manifest should say once the bank holds the new tracks
+
+    // the bank's summary and write, an exception in either reported against the bank
+    void finish() {
+        try {
+            report_and_write();
+        }
+        catch (const std::exception& e) {
+            printf("Failed to write %s: %s\n", bank_path.string().c_str(), e.what());
+        }
+    }
+
+    void report_and_write() {
+        auto successes = 0, unchanged = 0;
+        for (int i = 0; i < int(results.size()); ++i) {
+            if (results[i] == WBK_OK) {
+                printf("Replaced index %d\n", i);
+                successes++;
+            }
+            else if (results[i] == Unchanged)
+                unchanged++;
+            else if (results[i] == Missing)
+                printf("Replacement track not found for index %d!\n", i);
+            else if (results[i] == BadWav || results[i] == WBK_READ_ERROR)
+                printf("This WAV failed to parse\n");
+            else if (results[i] == WBK_BAD_SAMPLE_RATE)
+                printf("The WAV for index %d is above 65535 Hz, resample it with -s!\n", i);
+            else
+                printf("Failed to replace index %d!\n", i);
+        }
+        printf("Replaced %d/%zd entries\n", successes, wbk.entries.size());
+        if (has_manifest)
+            printf("Skipped %d unchanged entries\n", unchanged);
+
+        // the .new.wbk is rewritten even when nothing changed so it never lags behind the folder
+        bool ok = false;
+        if (batch->size() || (has_manifest && !opts.in_place)) {
+            ok = write_batch(*batch, bank_path, opts.in_place) == WBK_OK;
+            if (ok)
+                ++*written;
+        }
+
+        if (has_manifest) {
+            // only a patched bank holds the new tracks, a .new.wbk is built from the original again next time
+            if (ok && opts.in_place) {
+                for (auto& track : replaced) {
+                    if (track.index >= 0)
+                        manifest.tracks[track.index] = std::move(track);
+                }
+            }
+            if (!manifest.save(manifest_path))
+                printf("Failed to write %s!\n", manifest_path.string().c_str());
+        }
+    }
+};
+
+static void replace_bank_folder(ThreadPool& pool, const fs::path& bank_path, const fs::path& replace_path, const ToolOptions& opts, std::atomic<int>& written)
+{
+    auto job = std::make_shared<ReplaceJob>();
+    job->bank_path = bank_path;
+    job->opts = opts;
+    job->written = &written;
+    try {
+        if (job->wbk.map(bank_path) != WBK_OK) {
+            printf("Failed to parse %s!\n", bank_path.string().c_str());
+            return;
+        }
+    }
+    catch (const std::exception& e) {
+        printf("%s: %s\n", bank_path.string().c_str(), e.what());
+        return;
+    }
+    job->wbk.set_encode_cache(opts.cache);
+    job->wbk.set_adpcm1_preset(opts.preset);
+    job->wbk.set_encode_threads(opts.num_threads);
+    job->wbk.set_resample_rate(opts.resample_rate);
+    job->batch = std::make_unique<WBK::Batch>(job->wbk);
+    job->results.assign(job->wbk.entries.size(), ReplaceJob::Missing);
+
+    job->manifest_path = replace_path / Manifest::file_name;
+    job->has_manifest = job->manifest.load(job->manifest_path, job->wbk.entries.size());
+    if (job->has_manifest)
+        job->replaced.resize(job->wbk.entries.size());
+
+    std::vector<std::pair<int, fs::path>> tracks;
+    for (int i = 0; i < int(job->wbk.entries.size()); ++i) {
+        fs::path wav_file = replace_path / make_filename(job->wbk, opts, i);
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        if (!Manifest::stat(wav_file, size, mtime))
+            continue;
+
+        // same size and time as when it was extracted, no need to even open it
+        const Manifest::Track* track = job->manifest.find(i);
+        if (manifest_matches(track, job->wbk.entries[i], opts.codec) && track->size == size && track->mtime == mtime) {
+            job->results[i] = ReplaceJob::Unchanged;
+            continue;
+        }
+        tracks.emplace_back(i, std::move(wav_file));
+    }
+
+    job->remaining = int(tracks.size());
+    if (tracks.empty()) {
+        job->finish();
+        return;
+    }
+
+    for (auto& [index, wav_file] : tracks) {
+        pool.submit([job, index, wav_file = std::move(wav_file)] {
+            try {
+                // streamed into the encoder, only a block of the file is in memory at a time
+                WAV::Reader replacement_wav;
+                if (!replacement_wav.open(wav_file, job->opts.dither))
+                    job->results[index] = ReplaceJob::BadWav;
+                else if (!job->has_manifest)
+                    job->results[index] = job->batch->replace(index, replacement_wav, job->opts.codec);
+                else {
+                    Manifest::Track now;
+                    now.index = index;
+                    now.file = wav_file.filename().string();
+                    now.content_hash = hash_samples(replacement_wav);
+                    now.channels = replacement_wav.info().numChannels;
+                    now.rate = int(replacement_wav.info().sampleRate);
+                    Manifest::stat(wav_file, now.size, now.mtime);
+
+                    // touched but not edited, e.g. a fresh checkout: remember the new time and size
+                    Manifest::Track& track = job->manifest.tracks[index];
+                    const WBK::nslWave& entry = job->wbk.entries[index];
+                    if (manifest_matches(&track, entry, job->opts.codec) && track.content_hash == now.content_hash &&
+                        track.channels == now.channels && track.rate == now.rate) {
+                        track.size = now.size;
+                        track.mtime = now.mtime;
+                        job->results[index] = ReplaceJob::Unchanged;
+                    }
+                    else {
+                        job->results[index] = job->batch->replace(index, replacement_wav, job->opts.codec);
+                        now.hash = uint32_t(entry.hash);
+                        now.codec = job->opts.codec == WBK::Keep ? entry.codec : job->opts.codec;
+                        if (job->results[index] == WBK_OK)
+                            job->replaced[index] = std::move(now);
+                    }
+                }
+            }
+            catch (const std::exception& e) {
+                printf("%s: %s\n", wav_file.string().c_str(), e.what());
+                job->results[index] = ReplaceJob::Failed;
+            }
+
+            if (--job->remaining == 0)
+                job->finish();
+        });
+    }
+}
+
 int main(int argc, char** argv)
 {
-    if (argc < 3 || argc > 7) {
+    if (argc < 3) {
         printf("Usage:\n");
-        printf("  %s -e <.wbk> <output_folder>\n", argv[0]);
-        printf("  %s -r <.wbk> <index|folder> <replacement.wav (if index)>\n", argv[0]);
+        printf("  %s -e <.wbk|folder|banks.txt> <output_folder>\n", argv[0]);
+        printf("  %s -r <.wbk|folder|banks.txt> <index|folder> <replacement.wav (if index)>\n", argv[0]);
+        printf("               with several banks each one gets its own sub folder, named after the bank\n");
+        printf("  %s -d <dictionary.txt> [dictionary.bin]   Compile the string hash dictionary\n", argv[0]);
+        printf("  %s -x <.wbk|folder|hashes.txt> <wordlist.txt> <pattern...>   Recover names for unresolved hashes\n", argv[0]);
+        printf("               patterns mix text with {w} (each word) and {n:A-B} (numbers, {n:00-99} zero pads)\n");
+        printf("               a {n:A-B} holds at most %llu numbers, {n:0-99}{n:000000-999999} covers more\n", (unsigned long long)HashCracker::max_range);
         printf("\nOptions:\n");
         printf("  -h           Treat indices as hashes\n");
         printf("  -n           Treat indices as string hashes (requires string_hash_dictionary.txt)\n");
+        printf("  -j <threads> Extract/replace using this many threads, long ADPCM_1 tracks encode on several (default: 1)\n");
+        printf("  -i           Patch the .wbk itself instead of writing a .new.wbk\n");
+        printf("  -k <folder>  Keep encoded replacements in this folder and reuse them for unchanged WAVs\n");
+        printf("  -p <preset>  ADPCM_1 encoder preset: fast, balanced (default) or quality\n");
+        printf("  -s <rate>    Resample replacements to this rate, 0 for the rate of the entry they replace\n");
+        printf("  -t           TPDF dither 24/32-bit and float WAVs down to 16 bits\n");
         printf("  -c <codec>   Set codec when replacing:\n");
         printf("               1: PCM\n");
         printf("               2: PCM2\n");
@@ -23,10 +479,35 @@ int main(int argc, char** argv)
     }
 
     bool extract = false;
-    bool hashSearch = false;
-    bool resolveHashes = false;
+    ToolOptions opts;
     int replace_idx = -1;
+    unsigned num_threads = 1;
     std::filesystem::path replace_path;
+    std::unique_ptr<EncodeCache> cache;
+
+    if (strcmp(argv[1], "-d") == 0) {
+        fs::path compiled_path = argc > 3 ? fs::path(argv[3]) : fs::path(argv[2]).replace_extension(".bin");
+        auto count = compile_string_hash_dictionary(argv[2], compiled_path);
+        if (count < 0) {
+            printf("Failed to compile %s!\n", argv[2]);
+            return -1;
+        }
+        printf("Compiled %lld names to %s\n", count, compiled_path.string().c_str());
+        return 1;
+    }
+
+    if (strcmp(argv[1], "-x") == 0) {
+        if (argc < 5) {
+            printf("Usage: %s -x <.wbk|folder|hashes.txt> <wordlist.txt> <pattern...> [-j threads]\n", argv[0]);
+            return -1;
+        }
+        return crack_hashes(argc, argv);
+    }
+
+    if (argc < 4) {
+        printf("Invalid arguments specified!\n");
+        return -1;
+    }
 
     if (strstr(argv[1], "-e")) {
         extract = true;
@@ -48,7 +529,6 @@ int main(int argc, char** argv)
         return -1;
     }
 
-    WBK::Codec codec = WBK::Keep;
     for (int i = 1; i < argc; ++i)
     {
         int nextIdx = (i + 1 < argc) ? i + 1 : argc;
@@ -56,114 +536,150 @@ int main(int argc, char** argv)
         {
             auto codecType = atoi(argv[nextIdx]);
             if (codecType >= WBK::PCM && codecType <= WBK::IMA_ADPCM)
-                codec = (WBK::Codec)codecType;
+                opts.codec = (WBK::Codec)codecType;
             else {
                 printf("Invalid codec type specified!");
                 return -1;
             }
         }
+        if (strcmp(argv[i], "-j") == 0 && nextIdx < argc)
+        {
+            auto threads = atoi(argv[nextIdx]);
+            if (threads > 0)
+                num_threads = unsigned(threads);
+            else {
+                printf("Invalid thread count specified!");
+                return -1;
+            }
+        }
+        if (strcmp(argv[i], "-i") == 0)
+            opts.in_place = true;
+        if (strcmp(argv[i], "-t") == 0)
+            opts.dither = true;
+        if (strcmp(argv[i], "-p") == 0 && nextIdx < argc) {
+            if (strcmp(argv[nextIdx], "fast") == 0)
+                opts.preset = Adpcm1Encoder::Fast;
+            else if (strcmp(argv[nextIdx], "balanced") == 0)
+                opts.preset = Adpcm1Encoder::Balanced;
+            else if (strcmp(argv[nextIdx], "quality") == 0)
+                opts.preset = Adpcm1Encoder::Quality;
+            else {
+                printf("Invalid encoder preset specified!");
+                return -1;
+            }
+            ++i;
+            continue;
+        }
+        if (strcmp(argv[i], "-s") == 0 && nextIdx < argc) {
+            const int rate = atoi(argv[nextIdx]);
+            if (rate < 0 || rate > 0xFFFF || (rate == 0 && strcmp(argv[nextIdx], "0") != 0)) {
+                printf("Invalid sample rate specified!");
+                return -1;
+            }
+            opts.resample_rate = rate;
+            ++i;
+            continue;
+        }
+        if (strcmp(argv[i], "-k") == 0 && nextIdx < argc) {
+            cache = std::make_unique<EncodeCache>(argv[nextIdx]);
+            opts.cache = cache.get();
+            ++i;    // the folder name isn't an option
+            continue;
+        }
         if (strstr(argv[i], "-h"))
-            hashSearch = true;
+            opts.hashSearch = true;
         if (strstr(argv[i], "-n"))
-            resolveHashes = true;
+            opts.resolveHashes = true;
     }
 
-    if (!hashSearch && resolveHashes)
-        hashSearch = true;
-
-    WBK wbk;
+    if (!opts.hashSearch && opts.resolveHashes)
+        opts.hashSearch = true;
+    opts.num_threads = num_threads;
 
+    // load the dictionary once up front instead of in whichever task asks first
+    if (opts.resolveHashes)
+        get_string_hash_dictionary();
 
-    auto make_filename = [&wbk, &resolveHashes](bool hash, int i) {
-        auto h = lookup_string_by_hash(wbk.entries[i].hash);
-        return hash ? resolveHashes && !h.empty() ?
-                        std::format("{}.wav", h)
-                        : std::format("0x{:08x}.wav", wbk.entries[i].hash)
-                    : std::format("{}.wav", i);
-    };
+    // a folder or list of banks instead of a single .wbk runs every bank on one shared pool
+    const bool multi_bank = !is_wbk_path(argv[2]);
+    std::vector<std::pair<fs::path, fs::path>> banks;
+    if (multi_bank) {
+        banks = collect_banks(argv[2]);
+        if (banks.empty()) {
+            printf("No banks found in %s!\n", argv[2]);
+            return -1;
+        }
+    }
+    else
+        banks.emplace_back(argv[2], fs::path());
 
     if (extract)
     {
-        if (wbk.read(argv[2]) != WBK_OK)
-            return WBK_PARSE_FAILED;
-
-        auto base_path = std::string(argv[3]);
-        if (!fs::exists(base_path))
-            fs::create_directories(base_path);
-        size_t index = 0;
-        for (auto& track : wbk.tracks) {
-            WBK::nslWave& entry = wbk.entries[index];
-            auto name = make_filename(hashSearch, static_cast<int>(index));
-            fs::path output_path = fs::path(base_path) / name;
-            WAV::writeWAV(output_path.string(), track, entry.samples_per_second, WBK::GetNumChannels(entry));
-            ++index;
+        ThreadPool pool(num_threads);
+        for (const auto& [bank_path, sub_folder] : banks) {
+            pool.submit([&pool, &opts, bank_path, output_path = fs::path(argv[3]) / sub_folder] {
+                extract_bank(pool, bank_path, output_path, opts);
+            });
         }
+        pool.wait();
         return 1;
     }
-    else {
-        wbk.read(argv[2], false);
+    else if (!replace_path.empty()) {
+        if (multi_bank && !fs::is_directory(replace_path)) {
+            printf("Replacing several banks needs a folder of replacement folders!\n");
+            return -1;
+        }
 
-        bool modified = false;
-        if (replace_path.empty() && replace_idx != -1 && (!hashSearch && (replace_idx >= wbk.header.num_entries))) {
+        std::atomic<int> written{ 0 };
+        ThreadPool pool(num_threads);
+        for (const auto& [bank_path, sub_folder] : banks) {
+            pool.submit([&pool, &opts, &written, bank_path, wav_folder = replace_path / sub_folder] {
+                replace_bank_folder(pool, bank_path, wav_folder, opts, written);
+            });
+        }
+        pool.wait();
+        if (cache)
+            printf("Encode cache: %zu hits, %zu misses\n", cache->hits(), cache->misses());
+        return written ? 1 : 0;
+    }
+    else if (replace_idx != -1) {
+        WBK wbk;
+        wbk.map(argv[2]);
+        wbk.set_encode_cache(opts.cache);
+        wbk.set_adpcm1_preset(opts.preset);
+        wbk.set_encode_threads(opts.num_threads);
+        wbk.set_resample_rate(opts.resample_rate);
+
+        WBK::Batch batch(wbk);
+        if (!opts.hashSearch && (replace_idx >= wbk.header.num_entries)) {
             printf("Invalid replacement index specified!\n");
         }
-        else if (replace_idx != -1 || !replace_path.empty()) {
-            if (!replace_path.empty()) {
-                auto successes = 0;
-                for (int i = 0; i < wbk.entries.size(); ++i) {
-                    auto name = make_filename(hashSearch, i);
-                    const fs::path wav_file = replace_path / name;
-
-                    if (fs::exists(wav_file)) {
-                        WAV replacement_wav;
-                        if (replacement_wav.readWAV(wav_file.string())) {
-                            if (wbk.replace(i, replacement_wav, codec) == WBK_OK) {
-                                printf("Replaced index %d\n", i);
-                                modified = true;
-                                successes++;
-                            }
-                            else
-                                printf("Failed to replace index %d!\n", i);
-                        }
-                        else {
-                            printf("This WAV failed to parse\n");
-                        }
-                    }
-                    else
-                        printf("Replacement track not found for index %d!\n", i);
+        else {
+            WAV replacement_wav;
+            if (argc > 4 && replacement_wav.readWAV(argv[4], opts.dither)) {
+                if (opts.hashSearch) {
+                    if (opts.resolveHashes) 
+                        replace_idx = string_hash::to_hash(argv[3]);
+                    
+                    replace_idx = wbk.find(replace_idx);
+                    if (replace_idx == -1)
+                        return WBK_HASH_NOT_FOUND;
                 }
-                printf("Replaced %d/%zd entries\n", successes, wbk.entries.size());
+
+                const int res = batch.replace(replace_idx, replacement_wav, opts.codec);
+                if (res == WBK_OK)
+                    printf("Replaced index %d\n", replace_idx);
+                else if (res == WBK_BAD_SAMPLE_RATE)
+                    printf("The WAV is above 65535 Hz, resample it with -s!\n");
             }
             else {
-                WAV replacement_wav;
-                if (replacement_wav.readWAV(argv[4])) {
-                    if (hashSearch) {
-                        if (resolveHashes) 
-                            replace_idx = string_hash::to_hash(argv[3]);
-                        
-                        auto it = std::find_if(wbk.entries.begin(), wbk.entries.end(), [replace_idx](const WBK::nslWave& p) { return p.hash == replace_idx; });
-                        if ((it == wbk.entries.end())) 
-                            return WBK_HASH_NOT_FOUND;
-
-                        replace_idx = static_cast<int>(std::distance(wbk.entries.begin(), it));
-                    }
-
-                    if (wbk.replace(replace_idx, replacement_wav, codec) == WBK_OK) {
-                        modified = true;
-                        printf("Replaced index %d\n", replace_idx);
-                    }
-                }
-                else {
-                    printf("This WAV failed to parse\n");
-                }
+                printf("This WAV failed to parse\n");
             }
         }
         
-        if (modified) {
-            fs::path path = fs::path(std::string(argv[2])).replace_extension(".new.wbk").string();
-            wbk.write(path);
-            printf("Written to %s\n", path.string().c_str());
-            return 1;
+        if (batch.size()) {
+            int res = write_batch(batch, argv[2], opts.in_place);
+            return res == WBK_OK ? 1 : res;
         }
     }
     return 0;